@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+//---------------------------------------------------------------------------
+// Delta reports split the raw report buffer into fixed-size chunks.  A delta
+// payload is a change mask with one bit per chunk (LSB first), followed by the
+// bytes of each changed chunk in order.  The final chunk may be shorter than
+// DELTA_CHUNK_SIZE if the report size is not a multiple of it.
+//---------------------------------------------------------------------------
+#define DELTA_CHUNK_SIZE ((size_t)(4))
+
+//---------------------------------------------------------------------------
+/**
+ * @brief delta_mask_size return the size of the change mask for a report
+ * @param reportSize_ size of the raw report in bytes
+ * @return size of the change mask in bytes
+ */
+size_t delta_mask_size(size_t reportSize_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief delta_max_size return the largest delta payload that can be produced
+ * for a report of the given size (every chunk changed).
+ * @param reportSize_ size of the raw report in bytes
+ * @return worst-case delta payload size in bytes
+ */
+size_t delta_max_size(size_t reportSize_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief delta_encode encode the difference between two reports
+ * @param previous_ report the receiver already holds
+ * @param current_ report to transmit
+ * @param reportSize_ size of both reports in bytes
+ * @param out_ [out] buffer of at least delta_max_size(reportSize_) bytes
+ * @return size of the encoded delta payload in bytes
+ */
+size_t delta_encode(const uint8_t *previous_, const uint8_t *current_, size_t reportSize_, uint8_t *out_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief delta_apply apply a delta payload to a report in place
+ * @param report_ [in|out] report to update
+ * @param reportSize_ size of the report in bytes
+ * @param delta_ delta payload produced by delta_encode
+ * @param deltaLen_ size of the delta payload in bytes
+ * @return true if the payload was well-formed and applied, false otherwise
+ * (report_ is left untouched on failure)
+ */
+bool delta_apply(uint8_t *report_, size_t reportSize_, const uint8_t *delta_, size_t deltaLen_);
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
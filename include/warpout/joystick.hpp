@@ -37,32 +37,107 @@ typedef struct __attribute__((packed)) {
     uint32_t buttons[KEY_CNT]; //!< IDs for each key/button supported
 } js_config_t;
 
+//---------------------------------------------------------------------------
+// Absolute axis of a compact configuration
+typedef struct {
+    uint16_t code;      //!< ID of the axis
+    int32_t minimum;    //!< Minimum possible value for the axis
+    int32_t maximum;    //!< Maximum possible value for the axis
+    int32_t fuzz;       //!< If Changes are within X counts, ignore
+    int32_t flat;       //!< Dead-zone for the axis
+    int32_t resolution; //!< Resolution of the axis (unitless)
+} js_abs_axis_t;
+
+//---------------------------------------------------------------------------
+// Compact device configuration: what a js_config_t describes, holding only the
+// populated entries.  The name and arrays share one allocation with the
+// structure (see joystick_config_create).
+typedef struct {
+    char *name;   //!< Device "friendly" name (NUL-terminated)
+    uint16_t vid; //!< USB Device Vendor ID
+    uint16_t pid; //!< USB Device Product ID
+
+    int32_t absAxisCount; //!< Number of absolute axis supported on this device
+    int32_t relAxisCount; //!< Number of relative axis supported on this device
+    int32_t buttonCount;  //!< Number of buttons supported on this device
+
+    js_abs_axis_t *absAxis; //!< Each absolute axis
+    uint16_t *relAxis;      //!< IDs for each relative axis
+    uint16_t *buttons;      //!< IDs for each key/button supported
+} js_compact_config_t;
+
+//---------------------------------------------------------------------------
+// Encoded form of a js_compact_config_t: this header, then the name (nameLen
+// bytes, not terminated), then for each absolute axis its code (uint16_t) and
+// minimum, maximum, fuzz, flat and resolution (int32_t each), then the code of
+// each relative axis and each button (uint16_t each).  All fields are packed.
+typedef struct __attribute__((packed)) {
+    uint16_t vid;
+    uint16_t pid;
+    uint8_t nameLen;
+    uint8_t absAxisCount;
+    uint8_t relAxisCount;
+    uint16_t buttonCount;
+} js_compact_config_header_t;
+
 //---------------------------------------------------------------------------
 // Report data structure, used to report joystick state to the client
 typedef struct {
+    uint8_t *data; //!< Contiguous report buffer that the fields below point into
+
     int32_t *absAxis;
     int32_t *relAxis;
-    uint8_t *buttons;
+    uint8_t *buttons; //!< One bit per button, LSB first (button i is bit i % 8 of byte i / 8)
 } js_report_t;
 
+//---------------------------------------------------------------------------
+// Accessors for the bit-packed button field of a report
+static inline bool joystick_report_get_button(const js_report_t *report_, int button_) {
+    return (report_->buttons[button_ / 8] >> (button_ % 8)) & 1;
+}
+
+static inline void joystick_report_set_button(js_report_t *report_, int button_, bool set_) {
+    uint8_t mask = (uint8_t)(1u << (button_ % 8));
+    if (set_) {
+        report_->buttons[button_ / 8] |= mask;
+    } else {
+        report_->buttons[button_ / 8] &= (uint8_t)(~mask);
+    }
+}
+
+//---------------------------------------------------------------------------
+// Optional replacement for writing a report's events to the uinput fd, e.g. to
+// queue them with an event loop.  Returns false if it did not take the events,
+// in which case they are written directly.
+typedef bool (*js_write_hook_t)(int fd_, const void *data_, size_t len_);
+
 //---------------------------------------------------------------------------
 // Data structure that describes the instance of a joystick
 typedef struct {
     int fd; //!< fd corresponding to a server connection
 
-    js_config_t config; //!< configuration data for the object
+    js_compact_config_t *config; //!< configuration data for the object (owned)
 
     js_report_t previousReport; //!< previous joystick report data
     js_report_t currentReport;  //!< current joystick report data
+
+    size_t reportSize; //!< Size of the report buffers in bytes
+
+    struct input_event *events;  //!< Pre-filled events, one per report field followed by SYN_REPORT
+    struct input_event *changes; //!< Scratch space for the events emitted by joystick_end_update
+    size_t eventCount;           //!< Number of entries in events / changes
+
+    js_write_hook_t writeHook; //!< Optional; offered the events of each report before writing them
 } js_context_t;
 
 //---------------------------------------------------------------------------
 /**
  * @brief joystick_create Construct a new joystick object based on the configuration provided
- * @param config_ data that describes the device to create
+ * @param config_ data that describes the device to create.  The context takes
+ * ownership of it, and destroys it along with the context.
  * @return newly-constructed joystick context, or NULL on error initiatlizing the context
  */
-js_context_t *joystick_create(const js_config_t *config_);
+js_context_t *joystick_create(js_compact_config_t *config_);
 
 //---------------------------------------------------------------------------
 /**
@@ -72,6 +147,17 @@ js_context_t *joystick_create(const js_config_t *config_);
  */
 void joystick_destroy(js_context_t *context_);
 
+//---------------------------------------------------------------------------
+/**
+ * @brief joystick_write_events submit a batch of input events to the uinput
+ * device in a single write, resuming after partial writes.
+ * @param context_ pointer to the joystick context_ owning the uinput device
+ * @param events_ events to submit
+ * @param count_ number of events in events_
+ * @return true if every event was written to the device
+ */
+bool joystick_write_events(const js_context_t *context_, const struct input_event *events_, size_t count_);
+
 //---------------------------------------------------------------------------
 /**
  * @brief joystick_begin_update indicate the beginning of a new report is taking
@@ -86,7 +172,7 @@ void joystick_begin_update(js_context_t *context_);
  * @brief joystick_update_button Update the state of a specified button in the current
  * report.
  * @param context_ pointer to the joystick context_ object corresponding to the event
- * @param button_ ID of the button to update
+ * @param button_ index of the button in the device configuration
  * @param set_ value to set the button to (0 == not set, 1 == set)
  */
 void joystick_update_button(js_context_t *context_, int button_, uint8_t set_);
@@ -96,7 +182,7 @@ void joystick_update_button(js_context_t *context_, int button_, uint8_t set_);
  * @brief joystick_update_abs_axis Update the value of an absolute axis in the
  * current report.
  * @param context_ pointer to the joystick context_ object corresponding to the event
- * @param axis_ ID of the axis to update
+ * @param axis_ index of the axis in the device configuration
  * @param value_ value to set for the axis in the report
  */
 void joystick_update_abs_axis(js_context_t *context_, int axis_, int32_t value_);
@@ -106,11 +192,32 @@ void joystick_update_abs_axis(js_context_t *context_, int axis_, int32_t value_)
  * @brief joystick_update_rel_axis Update the value of a relative axis in the
  * current report.
  * @param context_ pointer to the joystick context_ object corresponding to the event
- * @param axis_ ID of the axis to update
+ * @param axis_ index of the axis in the device configuration
  * @param value_ value to set for the axis in the report
  */
 void joystick_update_rel_axis(js_context_t *context_, int axis_, int32_t value_);
 
+//---------------------------------------------------------------------------
+/**
+ * @brief joystick_update_report Replace every field of the current report
+ * with the contents of a raw report buffer.
+ * @param context_ pointer to the joystick context_ object corresponding to the event
+ * @param report_ raw report of context_->reportSize bytes, laid out as
+ * described by joystick_report_init
+ */
+void joystick_update_report(js_context_t *context_, const void *report_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief joystick_end_update complete the current report, and emit only the
+ * fields that changed since the previous report to the uinput device (followed
+ * by SYN_REPORT).  Nothing is written if the report is unchanged.  Relative
+ * axes are deltas, and are emitted whenever they are non-zero.
+ * @param context_ pointer to the joystick context_ object to complete the report for
+ * @return true on success (including when nothing changed), false on write error
+ */
+bool joystick_end_update(js_context_t *context_);
+
 //---------------------------------------------------------------------------
 /**
  * @brief joystick_get_report_size Return the size of the report structure for
@@ -119,7 +226,82 @@ void joystick_update_rel_axis(js_context_t *context_, int axis_, int32_t value_)
  * @param context_ pointer to the joystick context_ to return the report size for
  * @return size of the report structure for a given joystick context
  */
-size_t joystick_get_report_size(const js_config_t *context_);
+size_t joystick_get_report_size(const js_compact_config_t *context_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief joystick_report_init point the fields of a report structure into a
+ * raw report buffer laid out for the given configuration.
+ * @param report_ [out] report structure to initialize
+ * @param config_ configuration describing the report layout
+ * @param data_ buffer of at least joystick_get_report_size() bytes
+ */
+void joystick_report_init(js_report_t *report_, const js_compact_config_t *config_, void *data_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief joystick_config_create allocate a compact configuration with room for
+ * the given number of entries, all zeroed.
+ * @param absAxisCount_ number of absolute axis
+ * @param relAxisCount_ number of relative axis
+ * @param buttonCount_ number of buttons
+ * @param nameLen_ length of the device name, without its terminator
+ * @return newly-allocated configuration, or NULL on allocation error
+ */
+js_compact_config_t *joystick_config_create(int32_t absAxisCount_, int32_t relAxisCount_, int32_t buttonCount_,
+                                            size_t nameLen_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief joystick_config_destroy free a configuration from joystick_config_create
+ * (or any function returning one).
+ * @param config_ configuration to free; may be NULL
+ */
+void joystick_config_destroy(js_compact_config_t *config_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief joystick_config_from_full build a compact configuration from a full one
+ * @param config_ full configuration, e.g. as received from a client
+ * @return newly-allocated configuration, or NULL if config_ is malformed
+ */
+js_compact_config_t *joystick_config_from_full(const js_config_t *config_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief joystick_config_to_full expand a compact configuration into a full one
+ * @param config_ compact configuration
+ * @param full_ [out] full configuration
+ */
+void joystick_config_to_full(const js_compact_config_t *config_, js_config_t *full_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief joystick_config_encoded_size return the size of a configuration once
+ * encoded (see js_compact_config_header_t).
+ * @param config_ configuration to encode
+ * @return encoded size in bytes
+ */
+size_t joystick_config_encoded_size(const js_compact_config_t *config_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief joystick_config_encode encode a configuration (see js_compact_config_header_t)
+ * @param config_ configuration to encode
+ * @param out_ [out] buffer of at least joystick_config_encoded_size() bytes
+ * @return encoded size in bytes
+ */
+size_t joystick_config_encode(const js_compact_config_t *config_, uint8_t *out_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief joystick_config_decode decode a configuration produced by
+ * joystick_config_encode.
+ * @param data_ encoded configuration
+ * @param len_ size of the encoded configuration in bytes
+ * @return newly-allocated configuration, or NULL if the data is malformed
+ */
+js_compact_config_t *joystick_config_decode(const uint8_t *data_, size_t len_);
 
 #if defined(__cplusplus)
 }
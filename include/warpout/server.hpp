@@ -9,39 +9,79 @@
 extern "C" {
 #endif
 
+//---------------------------------------------------------------------------
+// Outcome of a client_read_data_t call
+typedef enum {
+    ClientReadDrained = 0, //!< Read until EAGAIN; wait for the socket to become readable again
+    ClientReadPending,     //!< Budget used up with data possibly left; call again next round
+    ClientReadClosed,      //!< Peer closed or the connection failed; disconnect the client
+} client_read_result_t;
+
 //---------------------------------------------------------------------------
 // Function pointers used to implement the event-handlers for socket events
 //---------------------------------------------------------------------------
 typedef void *(*client_connect_handler_t)(int clientFd_);
 typedef void (*client_disconnect_handler_t)(void *clientContext_);
-typedef bool (*client_read_data_t)(int clientFd_, void *clientContext_);
+typedef client_read_result_t (*client_read_data_t)(int clientFd_, void *clientContext_, size_t budget_);
+typedef void (*datagram_read_data_t)(int datagramFd_);
+typedef bool (*client_receive_data_t)(void *clientContext_, uint8_t *data_, size_t len_);
 
 //---------------------------------------------------------------------------
 // Struct containing the handler functions for client events
 typedef struct {
     client_connect_handler_t onConnect;       //!< Action called when socket is connected
     client_disconnect_handler_t onDisconnect; //!< Action called when the socket is disconnected
-    client_read_data_t onReadData;            //!< Action called when there is data to read on the socket
+    client_read_data_t onReadData;            //!< Action called when there is data to read on the socket;
+                                              //!< reads at most budget_ bytes
+    datagram_read_data_t onDatagram;          //!< Optional; action called when datagrams are waiting on the UDP socket
+    client_receive_data_t onReceiveData;      //!< Optional; action called with data the server already received
+                                              //!< (io_uring backend).  data_ may be modified in place.
 } client_handlers_t;
 
+//---------------------------------------------------------------------------
+// Event loop implementations
+typedef enum {
+    ServerBackendEpoll = 0, //!< epoll readiness; onReadData reads from the socket
+    ServerBackendUring,     //!< io_uring completions; requires onReceiveData, falls back to epoll if unavailable
+} server_backend_t;
+
 //---------------------------------------------------------------------------
 // Per-client context
 typedef struct {
     bool inUse;        //!< Whether or not the context object is idle or active
     int clientFd;      //!< FD corresponding to the socket
     void *contextData; //!< Connection-specific pointer to app-specific data
+    int nextFree;      //!< Next idle slot on the free-list, or -1 (idle slots only)
+    uint32_t reuses;   //!< Times the slot has been released, to tell its clients apart
+    bool ready;        //!< Whether the client is on the ready list
+    int nextReady;     //!< Next client on the ready list, or -1
 } client_context_t;
 
 //---------------------------------------------------------------------------
 // Server master context
 typedef struct {
-    uint16_t port;                    //!< Port we're listening on
-    int serverFd;                     //!< Listening socket FD
-    int maxClients;                   //!< Max concurrent clients
-    client_handlers_t handlers;       //!< Your callbacks
-    client_context_t **clientContext; //!< Array [maxClients] of per-client slots
+    uint16_t port;                   //!< Port we're listening on
+    int serverFd;                    //!< Listening socket FD
+    int datagramFd;                  //!< UDP socket bound to the same address/port, or -1 without onDatagram.
+                                     //!< IP_PKTINFO is enabled on it.
+    int maxClients;                  //!< Max concurrent clients, or 0 for no limit
+    client_handlers_t handlers;      //!< Your callbacks
+    client_context_t *clientContext; //!< Contiguous per-client slots, grown on demand
+    int clientCapacity;              //!< Slots allocated in clientContext
+    int freeSlot;                    //!< Head of the idle slot free-list, or -1 if every slot is in use
+    int eventBatch;                  //!< Events fetched per epoll_wait; may be changed before server_run
+    server_backend_t backend;        //!< Event loop used by server_run; may be changed before server_run
+    size_t readBudget;               //!< Bytes a client may read per round; may be changed before server_run
+    int readyHead;                   //!< First client with data left to read, or -1
+    int readyTail;                   //!< Last client with data left to read, or -1
 } server_context_t;
 
+// Default for server_context_t::eventBatch
+#define SERVER_DEFAULT_EVENT_BATCH 64
+
+// Default for server_context_t::readBudget
+#define SERVER_DEFAULT_READ_BUDGET 16384
+
 //---------------------------------------------------------------------------/
 /**
  * @brief Create & bind a new server socket.
@@ -50,20 +90,64 @@ typedef struct {
  *                    interface name (e.g. "eth0"). If it parses as IPv4,
  *                    we bind() to that address. Otherwise we attempt
  *                    a SO_BINDTODEVICE.
- * @param port_       TCP port to bind/listen on.
- * @param maxClients_ Max simultaneous clients (also used as backlog).
+ * @param port_       TCP port to bind/listen on.  If the handlers include
+ *                    onDatagram, a UDP socket is bound to the same port,
+ *                    with IP_PKTINFO enabled so replies can be sent
+ *                    from the address each datagram arrived on.
+ * @param maxClients_ Max simultaneous clients (also used as backlog), or 0
+ *                    for no limit.  The client table grows as needed.
  * @param clientHandlers_ Your client callbacks.
  * @return server_context_t* on success, NULL on error.
  */
 server_context_t *server_create(const char *bind_addr_, uint16_t port_, int maxClients_,
                                 client_handlers_t *clientHandlers_);
 
+/**
+ * @brief Steer clients across servers that share a port (SO_REUSEPORT).
+ *
+ * Servers created on the same address and port form a reuseport group, in
+ * creation order; running each from its own thread shards the clients.  This
+ * attaches classic BPF programs to the group so that:
+ *  - a datagram goes to the shard given by its first payload byte modulo
+ *    shardCount_, so the application can route a session to the shard that
+ *    owns it by choosing that byte;
+ *  - if steerStreams_ is set, a connection goes to the shard given by its
+ *    source IPv4 address modulo shardCount_, so reconnects from a host land
+ *    on the same shard.  Otherwise the kernel's hash spreads connections.
+ *
+ * @param shards_     Servers in creation order, all on the same address/port.
+ * @param shardCount_ Number of servers in shards_.
+ * @param steerStreams_ Whether to steer connections by source address.
+ * @return true on success, false if a program could not be attached.
+ */
+bool server_attach_shard_steering(server_context_t **shards_, int shardCount_, bool steerStreams_);
+
 /**
  * @brief Run the server loop.  Never returns unless fatal error.
  * @param context_ Context from server_create().
  */
 void server_run(server_context_t *context_);
 
+/**
+ * @brief Queue a write to a device fd from inside a handler.
+ *
+ * On a thread running the io_uring backend the data is copied to a staging
+ * area and written, in order with every write to the same fd queued before
+ * it, once the current batch of completions has been handled.  A failed
+ * write is logged, and so are the writes to the same fd that it cancelled.
+ * Fits js_write_hook_t.
+ *
+ * @param fd_   File descriptor to write to; must stay open until the client's
+ *              onDisconnect, which runs after every queued write completed.
+ *              Writes from onDisconnect itself must not be queued, as they
+ *              would only be made after it returns.
+ * @param data_ Data to write.
+ * @param len_  Bytes in data_.
+ * @return true if the write was queued, false if the caller must write itself
+ *         (any other backend, or data_ too large to stage).
+ */
+bool server_queue_write(int fd_, const void *data_, size_t len_);
+
 #if defined(__cplusplus)
 }
 #endif
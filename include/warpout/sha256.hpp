@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+//---------------------------------------------------------------------------
+// SHA-256 (FIPS 180-4), for identifying data by content where a checksum is
+// too weak to stand in for the data itself.
+//---------------------------------------------------------------------------
+#define SHA256_DIGEST_SIZE ((size_t)(32))
+#define SHA256_BLOCK_SIZE ((size_t)(64))
+
+//---------------------------------------------------------------------------
+// Struct used to hold the state of an incremental hash
+typedef struct {
+    uint32_t state[8];
+    uint64_t length;                  //!< Bytes hashed so far
+    uint8_t block[SHA256_BLOCK_SIZE]; //!< Input not yet compressed
+    size_t blockLen;                  //!< Bytes buffered in block
+} sha256_t;
+
+//---------------------------------------------------------------------------
+/**
+ * @brief sha256_init start a new hash
+ * @param ctx_ [out] hash state
+ */
+void sha256_init(sha256_t *ctx_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief sha256_update add data to a hash
+ * @param ctx_ [in|out] hash state
+ * @param data_ data to hash
+ * @param len_ length of the data in bytes
+ */
+void sha256_update(sha256_t *ctx_, const void *data_, size_t len_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief sha256_final finish a hash.  ctx_ must be initialised again before
+ * it is reused.
+ * @param ctx_ [in|out] hash state
+ * @param digest_ [out] SHA256_DIGEST_SIZE bytes of digest
+ */
+void sha256_final(sha256_t *ctx_, uint8_t *digest_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief sha256 hash a buffer in one call
+ * @param data_ data to hash
+ * @param len_ length of the data in bytes
+ * @param digest_ [out] SHA256_DIGEST_SIZE bytes of digest
+ */
+void sha256(const void *data_, size_t len_, uint8_t *digest_);
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
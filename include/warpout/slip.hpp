@@ -49,9 +49,17 @@ typedef struct {
     size_t rawSize; //!< Size of the buffer allocated for the decoded frame
 
     bool inEscape; //!< Indicates whether or not the message decoder is decoding an escape character
+    bool discard;  //!< Set while skipping the remainder of an invalid or oversized frame (buffer decoding)
     size_t index;  //!< Current write index in the buffer / size of the decoded frame (if complete)
 } slip_decode_message_t;
 
+//---------------------------------------------------------------------------
+// Span of a complete, unescaped frame produced by slip_decode_buffer
+typedef struct {
+    uint8_t *data; //!< First byte of the decoded frame
+    size_t len;    //!< Size of the decoded frame in bytes
+} slip_frame_t;
+
 //---------------------------------------------------------------------------
 /**
  * @brief slip_encode_message_create construct a new slip_encode_message_t
@@ -98,6 +106,19 @@ slip_encode_return_t slip_encode_finish(slip_encode_message_t *msg_);
  */
 slip_encode_return_t slip_encode_byte(slip_encode_message_t *msg_, uint8_t b_);
 
+//---------------------------------------------------------------------------
+/**
+ * @brief slip_encode_buffer encode a buffer of data into an in-progress frame.
+ * Produces the same output as calling slip_encode_byte for each byte, but
+ * scans for bytes that need escaping with SIMD (where available) and copies
+ * the runs in between in bulk.
+ * @param msg_ message to append
+ * @param data_ data to encode into the frame
+ * @param len_ number of bytes in data_
+ * @return SlipEncodeOk on success, others on errors.
+ */
+slip_encode_return_t slip_encode_buffer(slip_encode_message_t *msg_, const void *data_, size_t len_);
+
 //---------------------------------------------------------------------------
 /**
  * @brief slip_decode_message_create construct an object used to process and
@@ -135,6 +156,30 @@ void slip_decode_begin(slip_decode_message_t *msg_);
  */
 slip_decode_return_t slip_decode_byte(slip_decode_message_t *msg_, uint8_t b_);
 
+//---------------------------------------------------------------------------
+/**
+ * @brief slip_decode_buffer decode a buffer of received stream data, and
+ * return the complete frames found in it.  Frame boundaries and escapes are
+ * located with SIMD (where available), and frames are unescaped in place
+ * within buf_, so the returned spans point into buf_ without a copy.  Only a
+ * frame that is still incomplete at the end of buf_ is copied into the
+ * message's buffer, to be completed by the next call; when it completes, it
+ * is returned on its own from the message's buffer.  Empty, invalid and
+ * oversized frames are dropped.
+ * NOTE: spans are only valid until the next call on msg_, or until buf_ is
+ * modified.
+ * @param msg_ decoder state, carrying partial frames between calls
+ * @param buf_ [in|out] received data, decoded in place
+ * @param len_ number of bytes in buf_
+ * @param frames_ [out] array receiving the complete frames
+ * @param maxFrames_ capacity of frames_
+ * @param consumed_ [out] number of bytes of buf_ processed.  If less than
+ * len_, call again with the remaining bytes once the frames are handled.
+ * @return number of frames stored in frames_
+ */
+size_t slip_decode_buffer(slip_decode_message_t *msg_, uint8_t *buf_, size_t len_, slip_frame_t *frames_,
+                          size_t maxFrames_, size_t *consumed_);
+
 #if defined(__cplusplus)
 } // extern "C"
 #endif
@@ -16,10 +16,18 @@ typedef struct __attribute__((packed)) {
 } tlvc_header_t;
 
 //---------------------------------------------------------------------------
-// Struct used to represent the first elements of the tag-length-value-checksum
-// message.
+// Checksum algorithms that can protect a tlvc message
+typedef enum {
+    TlvcChecksumSum16 = 0, //!< 16-bit additive sum of the header + payload bytes (2-byte footer)
+    TlvcChecksumCrc32c     //!< CRC32C (Castagnoli) of the header + payload bytes (4-byte footer)
+} tlvc_checksum_t;
+
+//---------------------------------------------------------------------------
+// Struct used to represent the last elements of the tag-length-value-checksum
+// message.  Only the first tlvc_footer_size() bytes (little-endian) of the
+// checksum are transmitted.
 typedef struct __attribute__((packed)) {
-    uint16_t checksum;
+    uint32_t checksum;
 } tlvc_footer_t;
 
 //---------------------------------------------------------------------------
@@ -29,8 +37,18 @@ typedef struct {
     tlvc_footer_t footer;
     void *data;
     size_t dataLen;
+    tlvc_checksum_t checksumType; //!< Algorithm used for footer.checksum
 } tlvc_data_t;
 
+//---------------------------------------------------------------------------
+/**
+ * @brief tlvc_footer_size return the number of footer bytes transmitted for a
+ * given checksum algorithm.
+ * @param checksumType_ checksum algorithm
+ * @return footer size in bytes
+ */
+size_t tlvc_footer_size(tlvc_checksum_t checksumType_);
+
 //---------------------------------------------------------------------------
 /**
  * @brief tlvc_encode_data construct a tlvc object for a payload of data.
@@ -43,6 +61,21 @@ typedef struct {
  */
 void tlvc_encode_data(tlvc_data_t *tlvc_, uint16_t tag_, size_t dataLen_, void *data_);
 
+//---------------------------------------------------------------------------
+/**
+ * @brief tlvc_encode_data_checksum construct a tlvc object for a payload of
+ * data, protected by the given checksum algorithm.
+ * NOTE: the tlvc object must not outlive the data_ parameter, as it does not
+ * duplicate its data.
+ * @param tlvc_ [in|out] data structure that is constructured from the argument data
+ * @param tag_ value representing the tag type
+ * @param dataLen_ length of the payload data in bytes
+ * @param data_ payload data to encode
+ * @param checksumType_ checksum algorithm to compute the footer with
+ */
+void tlvc_encode_data_checksum(tlvc_data_t *tlvc_, uint16_t tag_, size_t dataLen_, void *data_,
+                               tlvc_checksum_t checksumType_);
+
 //---------------------------------------------------------------------------
 /**
  * @brief tlvc_decode_data decode a raw tlvc message into a
@@ -53,6 +86,18 @@ void tlvc_encode_data(tlvc_data_t *tlvc_, uint16_t tag_, size_t dataLen_, void *
  */
 bool tlvc_decode_data(tlvc_data_t *tlvc_, void *data_, size_t dataLen_);
 
+//---------------------------------------------------------------------------
+/**
+ * @brief tlvc_decode_data_checksum decode a raw tlvc message whose footer was
+ * computed with the given checksum algorithm.
+ * @param tlvc_ [in|out] data structure that is constructured from the argument data
+ * @param data_ pointer to a raw binary blob containing tlvc encoded payload
+ * @param dataLen_ size of the data_ blob in bytes
+ * @param checksumType_ checksum algorithm the footer was computed with
+ * @return true if the data stream was successfully decoded from the source data
+ */
+bool tlvc_decode_data_checksum(tlvc_data_t *tlvc_, void *data_, size_t dataLen_, tlvc_checksum_t checksumType_);
+
 #if defined(__cplusplus)
 } // extern "C"
 #endif
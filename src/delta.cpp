@@ -0,0 +1,71 @@
+#include "warpout/delta.hpp"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+//---------------------------------------------------------------------------
+static size_t delta_chunk_count(size_t reportSize_) { return (reportSize_ + DELTA_CHUNK_SIZE - 1) / DELTA_CHUNK_SIZE; }
+
+//---------------------------------------------------------------------------
+static size_t delta_chunk_len(size_t chunk_, size_t reportSize_) {
+    size_t offset = chunk_ * DELTA_CHUNK_SIZE;
+    return (reportSize_ - offset < DELTA_CHUNK_SIZE) ? (reportSize_ - offset) : DELTA_CHUNK_SIZE;
+}
+
+//---------------------------------------------------------------------------
+size_t delta_mask_size(size_t reportSize_) { return (delta_chunk_count(reportSize_) + 7) / 8; }
+
+//---------------------------------------------------------------------------
+size_t delta_max_size(size_t reportSize_) { return delta_mask_size(reportSize_) + reportSize_; }
+
+//---------------------------------------------------------------------------
+size_t delta_encode(const uint8_t *previous_, const uint8_t *current_, size_t reportSize_, uint8_t *out_) {
+    size_t chunks = delta_chunk_count(reportSize_);
+    size_t maskSize = delta_mask_size(reportSize_);
+    uint8_t *values = out_ + maskSize;
+
+    memset(out_, 0, maskSize);
+    for (size_t i = 0; i < chunks; i++) {
+        size_t offset = i * DELTA_CHUNK_SIZE;
+        size_t len = delta_chunk_len(i, reportSize_);
+        if (memcmp(previous_ + offset, current_ + offset, len) == 0) {
+            continue;
+        }
+        out_[i / 8] |= (uint8_t)(1u << (i % 8));
+        memcpy(values, current_ + offset, len);
+        values += len;
+    }
+    return (size_t)(values - out_);
+}
+
+//---------------------------------------------------------------------------
+bool delta_apply(uint8_t *report_, size_t reportSize_, const uint8_t *delta_, size_t deltaLen_) {
+    size_t chunks = delta_chunk_count(reportSize_);
+    size_t maskSize = delta_mask_size(reportSize_);
+    if (deltaLen_ < maskSize) {
+        return false;
+    }
+
+    // Validate the payload length against the mask before touching the report
+    size_t expected = maskSize;
+    for (size_t i = 0; i < chunks; i++) {
+        if (delta_[i / 8] & (1u << (i % 8))) {
+            expected += delta_chunk_len(i, reportSize_);
+        }
+    }
+    if (expected != deltaLen_) {
+        return false;
+    }
+
+    const uint8_t *values = delta_ + maskSize;
+    for (size_t i = 0; i < chunks; i++) {
+        if (delta_[i / 8] & (1u << (i % 8))) {
+            size_t len = delta_chunk_len(i, reportSize_);
+            memcpy(report_ + (i * DELTA_CHUNK_SIZE), values, len);
+            values += len;
+        }
+    }
+    return true;
+}
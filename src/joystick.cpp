@@ -6,19 +6,56 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <unistd.h>
 
 #include <linux/input.h>
 #include <linux/uinput.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 //---------------------------------------------------------------------------
-static js_context_t *joystick_create_context(const js_config_t *config_) {
+static js_context_t *joystick_create_context(js_compact_config_t *config_) {
     js_context_t *newContext = (js_context_t *)(calloc(1, sizeof(js_context_t)));
 
-    newContext->config = *config_;
+    newContext->config = config_;
     newContext->fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
 
+    // One event per report field, in report order, with type/code fixed up-front
+    // so that emitting a report only has to fill in the values.
+    newContext->eventCount = config_->absAxisCount + config_->relAxisCount + config_->buttonCount + 1;
+    newContext->events = (struct input_event *)(calloc(newContext->eventCount, sizeof(struct input_event)));
+
+    struct input_event *ev = newContext->events;
+    for (int i = 0; i < config_->absAxisCount; i++, ev++) {
+        ev->type = EV_ABS;
+        ev->code = config_->absAxis[i].code;
+    }
+    for (int i = 0; i < config_->relAxisCount; i++, ev++) {
+        ev->type = EV_REL;
+        ev->code = config_->relAxis[i];
+    }
+    for (int i = 0; i < config_->buttonCount; i++, ev++) {
+        ev->type = EV_KEY;
+        ev->code = config_->buttons[i];
+    }
+    ev->type = EV_SYN;
+    ev->code = SYN_REPORT;
+    newContext->changes = (struct input_event *)(calloc(newContext->eventCount, sizeof(struct input_event)));
+
+    // previous + current report share one allocation; both start zeroed, which
+    // matches the initial state of a freshly-created uinput device.  The second
+    // report is placed on an 8-byte boundary to keep its axes aligned.
+    newContext->reportSize = joystick_get_report_size(config_);
+    size_t reportStride = (newContext->reportSize + 7) & ~(size_t)(7);
+    uint8_t *reportData = (uint8_t *)(calloc(2, reportStride ? reportStride : 1));
+    joystick_report_init(&newContext->previousReport, config_, reportData);
+    joystick_report_init(&newContext->currentReport, config_, reportData + reportStride);
+
     return newContext;
 }
 
@@ -27,6 +64,10 @@ static void joystick_destroy_context(js_context_t *context_) {
     if (!context_) {
         return;
     }
+    free(context_->previousReport.data);
+    free(context_->changes);
+    free(context_->events);
+    joystick_config_destroy(context_->config);
     free(context_);
 }
 
@@ -35,9 +76,9 @@ static void joystick_add_device(const js_context_t *context_) {
     struct uinput_setup setup = {};
 
     setup.id.bustype = BUS_VIRTUAL;
-    setup.id.vendor = context_->config.vid;
-    setup.id.product = context_->config.pid;
-    strncpy(setup.name, context_->config.name, UINPUT_MAX_NAME_SIZE);
+    setup.id.vendor = context_->config->vid;
+    setup.id.product = context_->config->pid;
+    strncpy(setup.name, context_->config->name, UINPUT_MAX_NAME_SIZE);
 
     ioctl(context_->fd, UI_DEV_SETUP, &setup);
     ioctl(context_->fd, UI_DEV_CREATE);
@@ -45,33 +86,34 @@ static void joystick_add_device(const js_context_t *context_) {
 
 //---------------------------------------------------------------------------
 static void joystick_add_relative_axis(const js_context_t *context_) {
-    if (context_->config.relAxisCount <= 0) {
+    if (context_->config->relAxisCount <= 0) {
         return;
     }
 
     ioctl(context_->fd, UI_SET_EVBIT, EV_REL);
-    for (int i = 0; i < context_->config.relAxisCount; i++) {
-        ioctl(context_->fd, UI_SET_RELBIT, context_->config.relAxis[i]);
+    for (int i = 0; i < context_->config->relAxisCount; i++) {
+        ioctl(context_->fd, UI_SET_RELBIT, context_->config->relAxis[i]);
     }
 }
 
 //---------------------------------------------------------------------------
 static void joystick_add_absolute_axis(const js_context_t *context_) {
-    if (context_->config.absAxisCount <= 0) {
+    if (context_->config->absAxisCount <= 0) {
         return;
     }
 
     ioctl(context_->fd, UI_SET_EVBIT, EV_ABS);
-    for (int i = 0; i < context_->config.absAxisCount; i++) {
+    for (int i = 0; i < context_->config->absAxisCount; i++) {
         struct uinput_abs_setup setup = {};
 
-        setup.code = context_->config.absAxis[i];
+        const js_abs_axis_t *axis = &context_->config->absAxis[i];
+        setup.code = axis->code;
         setup.absinfo.value = 0;
-        setup.absinfo.minimum = context_->config.absAxisMin[i];
-        setup.absinfo.maximum = context_->config.absAxisMax[i];
-        setup.absinfo.fuzz = context_->config.absAxisFuzz[i];
-        setup.absinfo.flat = context_->config.absAxisFlat[i];
-        setup.absinfo.resolution = context_->config.absAxisResolution[i];
+        setup.absinfo.minimum = axis->minimum;
+        setup.absinfo.maximum = axis->maximum;
+        setup.absinfo.fuzz = axis->fuzz;
+        setup.absinfo.flat = axis->flat;
+        setup.absinfo.resolution = axis->resolution;
 
         ioctl(context_->fd, UI_ABS_SETUP, &setup);
     }
@@ -79,13 +121,13 @@ static void joystick_add_absolute_axis(const js_context_t *context_) {
 
 //---------------------------------------------------------------------------
 static void joystick_add_buttons(const js_context_t *context_) {
-    if (context_->config.buttonCount <= 0) {
+    if (context_->config->buttonCount <= 0) {
         return;
     }
 
     ioctl(context_->fd, UI_SET_EVBIT, EV_KEY);
-    for (int i = 0; i < context_->config.buttonCount; i++) {
-        ioctl(context_->fd, UI_SET_KEYBIT, context_->config.buttons[i]);
+    for (int i = 0; i < context_->config->buttonCount; i++) {
+        ioctl(context_->fd, UI_SET_KEYBIT, context_->config->buttons[i]);
     }
 }
 
@@ -96,7 +138,7 @@ static void joystick_add_force_feedback(const js_context_t *context_) {
 }
 
 //---------------------------------------------------------------------------
-js_context_t *joystick_create(const js_config_t *config_) {
+js_context_t *joystick_create(js_compact_config_t *config_) {
     js_context_t *context = joystick_create_context(config_);
 
     joystick_add_absolute_axis(context);
@@ -116,9 +158,368 @@ void joystick_destroy(js_context_t *context_) {
 }
 
 //---------------------------------------------------------------------------
-size_t joystick_get_report_size(const js_config_t *config) {
-    size_t reportSize = (sizeof(uint8_t) * config->buttonCount) + (sizeof(int32_t) * config->absAxisCount) +
+bool joystick_write_events(const js_context_t *context_, const struct input_event *events_, size_t count_) {
+    const uint8_t *raw = (const uint8_t *)(events_);
+    size_t remaining = count_ * sizeof(struct input_event);
+
+    while (remaining > 0) {
+        ssize_t written = write(context_->fd, raw, remaining);
+        if (written > 0) {
+            raw += written;
+            remaining -= written;
+            continue;
+        }
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written < 0 && errno == EAGAIN) {
+            // fd is O_NONBLOCK; wait for the device to accept more events
+            struct pollfd pfd = {.fd = context_->fd, .events = POLLOUT, .revents = 0};
+            poll(&pfd, 1, -1);
+            continue;
+        }
+        return false;
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------
+// Return the offset of the first byte at or after from_ that differs between
+// a_ and b_, or len_ if the ranges are identical.
+static size_t joystick_next_difference(const uint8_t *a_, const uint8_t *b_, size_t from_, size_t len_) {
+    size_t i = from_;
+#if defined(__SSE2__)
+    for (; i + 16 <= len_; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a_ + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b_ + i));
+        unsigned int equal = (unsigned int)(_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)));
+        if (equal != 0xFFFF) {
+            return i + __builtin_ctz(~equal);
+        }
+    }
+#endif
+    for (; i + 8 <= len_; i += 8) {
+        uint64_t wa, wb;
+        memcpy(&wa, a_ + i, sizeof(wa));
+        memcpy(&wb, b_ + i, sizeof(wb));
+        if (wa != wb) {
+            return i + (__builtin_ctzll(wa ^ wb) / 8);
+        }
+    }
+    for (; i < len_; i++) {
+        if (a_[i] != b_[i]) {
+            return i;
+        }
+    }
+    return len_;
+}
+
+//---------------------------------------------------------------------------
+void joystick_begin_update(js_context_t *context_) {
+    // relative axes carry per-report deltas, so they start every report at zero
+    memset(context_->currentReport.relAxis, 0, sizeof(int32_t) * context_->config->relAxisCount);
+}
+
+//---------------------------------------------------------------------------
+void joystick_update_button(js_context_t *context_, int button_, uint8_t set_) {
+    if (button_ < 0 || button_ >= context_->config->buttonCount) {
+        return;
+    }
+    joystick_report_set_button(&context_->currentReport, button_, set_ != 0);
+}
+
+//---------------------------------------------------------------------------
+void joystick_update_abs_axis(js_context_t *context_, int axis_, int32_t value_) {
+    if (axis_ < 0 || axis_ >= context_->config->absAxisCount) {
+        return;
+    }
+    context_->currentReport.absAxis[axis_] = value_;
+}
+
+//---------------------------------------------------------------------------
+void joystick_update_rel_axis(js_context_t *context_, int axis_, int32_t value_) {
+    if (axis_ < 0 || axis_ >= context_->config->relAxisCount) {
+        return;
+    }
+    context_->currentReport.relAxis[axis_] = value_;
+}
+
+//---------------------------------------------------------------------------
+void joystick_update_report(js_context_t *context_, const void *report_) {
+    memcpy(context_->currentReport.data, report_, context_->reportSize);
+}
+
+//---------------------------------------------------------------------------
+bool joystick_end_update(js_context_t *context_) {
+    const js_compact_config_t *config = context_->config;
+    const js_report_t *prev = &context_->previousReport;
+    const js_report_t *cur = &context_->currentReport;
+    struct input_event *out = context_->changes;
+    size_t count = 0;
+
+    // absolute axes: compare the packed int32 arrays and emit each axis that differs
+    const uint8_t *prevAbs = (const uint8_t *)(prev->absAxis);
+    const uint8_t *curAbs = (const uint8_t *)(cur->absAxis);
+    size_t absLen = sizeof(int32_t) * config->absAxisCount;
+    for (size_t off = joystick_next_difference(prevAbs, curAbs, 0, absLen); off < absLen;) {
+        size_t i = off / sizeof(int32_t);
+        out[count] = context_->events[i];
+        out[count++].value = cur->absAxis[i];
+        off = joystick_next_difference(prevAbs, curAbs, (i + 1) * sizeof(int32_t), absLen);
+    }
+
+    // relative axes: deltas, emitted whenever non-zero
+    const struct input_event *relEvents = context_->events + config->absAxisCount;
+    for (int i = 0; i < config->relAxisCount; i++) {
+        if (cur->relAxis[i] != 0) {
+            out[count] = relEvents[i];
+            out[count++].value = cur->relAxis[i];
+        }
+    }
+
+    // buttons: XOR the bit-packed fields a word at a time and walk the changed bits
+    const struct input_event *buttonEvents = relEvents + config->relAxisCount;
+    size_t buttonLen = (config->buttonCount + 7) / 8;
+    for (size_t off = 0; off < buttonLen; off += sizeof(uint64_t)) {
+        size_t len = (buttonLen - off < sizeof(uint64_t)) ? (buttonLen - off) : sizeof(uint64_t);
+        uint64_t wp = 0, wc = 0;
+        memcpy(&wp, prev->buttons + off, len);
+        memcpy(&wc, cur->buttons + off, len);
+        for (uint64_t changed = wp ^ wc; changed != 0; changed &= changed - 1) {
+            int bit = __builtin_ctzll(changed);
+            size_t i = off * 8 + bit;
+            if (i >= (size_t)(config->buttonCount)) {
+                break;
+            }
+            out[count] = buttonEvents[i];
+            out[count++].value = (wc >> bit) & 1;
+        }
+    }
+
+    memcpy(prev->data, cur->data, context_->reportSize);
+
+    if (count == 0) {
+        return true;
+    }
+    out[count++] = context_->events[context_->eventCount - 1];
+    if (context_->writeHook && context_->writeHook(context_->fd, out, count * sizeof(*out))) {
+        return true;
+    }
+    return joystick_write_events(context_, out, count);
+}
+
+//---------------------------------------------------------------------------
+size_t joystick_get_report_size(const js_compact_config_t *config) {
+    size_t reportSize = ((config->buttonCount + 7) / 8) + (sizeof(int32_t) * config->absAxisCount) +
                         (sizeof(int32_t) * config->relAxisCount);
 
     return reportSize;
 }
+
+//---------------------------------------------------------------------------
+void joystick_report_init(js_report_t *report_, const js_compact_config_t *config_, void *data_) {
+    uint8_t *raw = (uint8_t *)(data_);
+
+    report_->data = raw;
+    report_->absAxis = (int32_t *)(raw);
+    report_->relAxis = (int32_t *)(raw + sizeof(int32_t) * config_->absAxisCount);
+    report_->buttons = raw + sizeof(int32_t) * (config_->absAxisCount + config_->relAxisCount);
+}
+
+//---------------------------------------------------------------------------
+js_compact_config_t *joystick_config_create(int32_t absAxisCount_, int32_t relAxisCount_, int32_t buttonCount_,
+                                            size_t nameLen_) {
+    if (absAxisCount_ < 0 || absAxisCount_ > ABS_CNT || relAxisCount_ < 0 || relAxisCount_ > REL_CNT ||
+        buttonCount_ < 0 || buttonCount_ > KEY_CNT || nameLen_ > UINT8_MAX) {
+        return NULL;
+    }
+
+    // structure, then the arrays from the most to the least aligned, then the name
+    size_t absOffset = sizeof(js_compact_config_t);
+    size_t relOffset = absOffset + sizeof(js_abs_axis_t) * absAxisCount_;
+    size_t buttonOffset = relOffset + sizeof(uint16_t) * relAxisCount_;
+    size_t nameOffset = buttonOffset + sizeof(uint16_t) * buttonCount_;
+    uint8_t *block = (uint8_t *)(calloc(1, nameOffset + nameLen_ + 1));
+    if (!block) {
+        return NULL;
+    }
+
+    js_compact_config_t *config = (js_compact_config_t *)(block);
+    config->absAxisCount = absAxisCount_;
+    config->relAxisCount = relAxisCount_;
+    config->buttonCount = buttonCount_;
+    config->absAxis = (js_abs_axis_t *)(block + absOffset);
+    config->relAxis = (uint16_t *)(block + relOffset);
+    config->buttons = (uint16_t *)(block + buttonOffset);
+    config->name = (char *)(block + nameOffset);
+    return config;
+}
+
+//---------------------------------------------------------------------------
+void joystick_config_destroy(js_compact_config_t *config_) {
+    free(config_);
+}
+
+//---------------------------------------------------------------------------
+js_compact_config_t *joystick_config_from_full(const js_config_t *config_) {
+    size_t nameLen = strnlen(config_->name, sizeof(config_->name));
+    if (nameLen > UINT8_MAX) {
+        nameLen = UINT8_MAX;
+    }
+    js_compact_config_t *config =
+        joystick_config_create(config_->absAxisCount, config_->relAxisCount, config_->buttonCount, nameLen);
+    if (!config) {
+        return NULL;
+    }
+
+    memcpy(config->name, config_->name, nameLen);
+    config->vid = config_->vid;
+    config->pid = config_->pid;
+    bool valid = true;
+    for (int i = 0; i < config->absAxisCount; i++) {
+        js_abs_axis_t *axis = &config->absAxis[i];
+        valid = valid && config_->absAxis[i] < ABS_CNT;
+        axis->code = (uint16_t)(config_->absAxis[i]);
+        axis->minimum = config_->absAxisMin[i];
+        axis->maximum = config_->absAxisMax[i];
+        axis->fuzz = config_->absAxisFuzz[i];
+        axis->flat = config_->absAxisFlat[i];
+        axis->resolution = config_->absAxisResolution[i];
+    }
+    for (int i = 0; i < config->relAxisCount; i++) {
+        valid = valid && config_->relAxis[i] < REL_CNT;
+        config->relAxis[i] = (uint16_t)(config_->relAxis[i]);
+    }
+    for (int i = 0; i < config->buttonCount; i++) {
+        valid = valid && config_->buttons[i] < KEY_CNT;
+        config->buttons[i] = (uint16_t)(config_->buttons[i]);
+    }
+    if (!valid) {
+        joystick_config_destroy(config);
+        return NULL;
+    }
+    return config;
+}
+
+//---------------------------------------------------------------------------
+void joystick_config_to_full(const js_compact_config_t *config_, js_config_t *full_) {
+    memset(full_, 0, sizeof(*full_));
+    strncpy(full_->name, config_->name, sizeof(full_->name) - 1);
+    full_->vid = config_->vid;
+    full_->pid = config_->pid;
+    full_->absAxisCount = config_->absAxisCount;
+    full_->relAxisCount = config_->relAxisCount;
+    full_->buttonCount = config_->buttonCount;
+    for (int i = 0; i < config_->absAxisCount; i++) {
+        const js_abs_axis_t *axis = &config_->absAxis[i];
+        full_->absAxis[i] = axis->code;
+        full_->absAxisMin[i] = axis->minimum;
+        full_->absAxisMax[i] = axis->maximum;
+        full_->absAxisFuzz[i] = axis->fuzz;
+        full_->absAxisFlat[i] = axis->flat;
+        full_->absAxisResolution[i] = axis->resolution;
+    }
+    for (int i = 0; i < config_->relAxisCount; i++) {
+        full_->relAxis[i] = config_->relAxis[i];
+    }
+    for (int i = 0; i < config_->buttonCount; i++) {
+        full_->buttons[i] = config_->buttons[i];
+    }
+}
+
+//---------------------------------------------------------------------------
+// Size of one absolute axis once encoded: code, then the five int32 properties
+#define JS_ABS_AXIS_ENCODED_SIZE (sizeof(uint16_t) + 5 * sizeof(int32_t))
+
+static size_t joystick_config_name_length(const js_compact_config_t *config_) {
+    size_t nameLen = strlen(config_->name);
+    return (nameLen > UINT8_MAX) ? UINT8_MAX : nameLen;
+}
+
+//---------------------------------------------------------------------------
+size_t joystick_config_encoded_size(const js_compact_config_t *config_) {
+    return sizeof(js_compact_config_header_t) + joystick_config_name_length(config_) +
+           JS_ABS_AXIS_ENCODED_SIZE * config_->absAxisCount +
+           sizeof(uint16_t) * (config_->relAxisCount + config_->buttonCount);
+}
+
+//---------------------------------------------------------------------------
+size_t joystick_config_encode(const js_compact_config_t *config_, uint8_t *out_) {
+    js_compact_config_header_t header = {};
+    header.vid = config_->vid;
+    header.pid = config_->pid;
+    header.nameLen = (uint8_t)(joystick_config_name_length(config_));
+    header.absAxisCount = (uint8_t)(config_->absAxisCount);
+    header.relAxisCount = (uint8_t)(config_->relAxisCount);
+    header.buttonCount = (uint16_t)(config_->buttonCount);
+
+    uint8_t *out = out_;
+    memcpy(out, &header, sizeof(header));
+    out += sizeof(header);
+    memcpy(out, config_->name, header.nameLen);
+    out += header.nameLen;
+    for (int i = 0; i < config_->absAxisCount; i++) {
+        const js_abs_axis_t *axis = &config_->absAxis[i];
+        int32_t values[5] = {axis->minimum, axis->maximum, axis->fuzz, axis->flat, axis->resolution};
+        memcpy(out, &axis->code, sizeof(axis->code));
+        memcpy(out + sizeof(axis->code), values, sizeof(values));
+        out += JS_ABS_AXIS_ENCODED_SIZE;
+    }
+    memcpy(out, config_->relAxis, sizeof(uint16_t) * config_->relAxisCount);
+    out += sizeof(uint16_t) * config_->relAxisCount;
+    memcpy(out, config_->buttons, sizeof(uint16_t) * config_->buttonCount);
+    out += sizeof(uint16_t) * config_->buttonCount;
+    return (size_t)(out - out_);
+}
+
+//---------------------------------------------------------------------------
+js_compact_config_t *joystick_config_decode(const uint8_t *data_, size_t len_) {
+    js_compact_config_header_t header;
+    if (len_ < sizeof(header)) {
+        return NULL;
+    }
+    memcpy(&header, data_, sizeof(header));
+    if (len_ != sizeof(header) + header.nameLen + JS_ABS_AXIS_ENCODED_SIZE * header.absAxisCount +
+                    sizeof(uint16_t) * (header.relAxisCount + header.buttonCount)) {
+        return NULL;
+    }
+    js_compact_config_t *config =
+        joystick_config_create(header.absAxisCount, header.relAxisCount, header.buttonCount, header.nameLen);
+    if (!config) {
+        return NULL;
+    }
+    config->vid = header.vid;
+    config->pid = header.pid;
+
+    const uint8_t *in = data_ + sizeof(header);
+    memcpy(config->name, in, header.nameLen);
+    in += header.nameLen;
+    bool valid = strlen(config->name) == header.nameLen;
+    for (int i = 0; i < config->absAxisCount; i++) {
+        js_abs_axis_t *axis = &config->absAxis[i];
+        int32_t values[5];
+        memcpy(&axis->code, in, sizeof(axis->code));
+        memcpy(values, in + sizeof(axis->code), sizeof(values));
+        axis->minimum = values[0];
+        axis->maximum = values[1];
+        axis->fuzz = values[2];
+        axis->flat = values[3];
+        axis->resolution = values[4];
+        valid = valid && axis->code < ABS_CNT;
+        in += JS_ABS_AXIS_ENCODED_SIZE;
+    }
+    memcpy(config->relAxis, in, sizeof(uint16_t) * config->relAxisCount);
+    in += sizeof(uint16_t) * config->relAxisCount;
+    memcpy(config->buttons, in, sizeof(uint16_t) * config->buttonCount);
+    for (int i = 0; i < config->relAxisCount; i++) {
+        valid = valid && config->relAxis[i] < REL_CNT;
+    }
+    for (int i = 0; i < config->buttonCount; i++) {
+        valid = valid && config->buttons[i] < KEY_CNT;
+    }
+    if (!valid) {
+        joystick_config_destroy(config);
+        return NULL;
+    }
+    return config;
+}
@@ -3,10 +3,13 @@
 #include <arpa/inet.h> // inet_pton
 #include <errno.h>
 #include <fcntl.h>
+#include <linux/filter.h> // struct sock_filter, SKF_NET_OFF
+#include <linux/io_uring.h>
 #include <linux/socket.h> // SO_BINDTODEVICE
 #include <net/if.h>       // struct ifreq
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <poll.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -14,20 +17,21 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/epoll.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
 //---------------------------------------------------------------------------
-// Create + bind listening socket, set reuse, optional SO_BINDTODEVICE
+// Create + bind a socket, set reuse, optional SO_BINDTODEVICE
 //---------------------------------------------------------------------------
 
-server_context_t *server_create(const char *bind_addr_, uint16_t port_, int maxClients_,
-                                client_handlers_t *clientHandlers_) {
+static int server_bind_socket(int type_, const char *bind_addr_, uint16_t port_) {
     // 1) socket()
-    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int fd = socket(AF_INET, type_, 0);
     if (fd < 0) {
         fprintf(stderr, "socket() error: %s\n", strerror(errno));
-        return NULL;
+        return -1;
     }
     // 2) SO_REUSEADDR + SO_REUSEPORT
     int yes = 1;
@@ -35,7 +39,7 @@ server_context_t *server_create(const char *bind_addr_, uint16_t port_, int maxC
         setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) < 0) {
         fprintf(stderr, "setsockopt(REUSE): %s\n", strerror(errno));
         close(fd);
-        return NULL;
+        return -1;
     }
 
     // 3) Prepare sockaddr_in
@@ -58,40 +62,160 @@ server_context_t *server_create(const char *bind_addr_, uint16_t port_, int maxC
     if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
         fprintf(stderr, "bind(%s:%u) error: %s\n", bind_addr_, port_, strerror(errno));
         close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+//---------------------------------------------------------------------------
+// Create listening socket (+ optional datagram socket) and the server context
+//---------------------------------------------------------------------------
+
+server_context_t *server_create(const char *bind_addr_, uint16_t port_, int maxClients_,
+                                client_handlers_t *clientHandlers_) {
+    // non-blocking, so the listener can be drained until EAGAIN
+    int fd = server_bind_socket(SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, bind_addr_, port_);
+    if (fd < 0) {
         return NULL;
     }
 
     // 5) listen() using maxClients_ as backlog
-    if (listen(fd, maxClients_) < 0) {
+    if (listen(fd, maxClients_ > 0 ? maxClients_ : SOMAXCONN) < 0) {
         fprintf(stderr, "listen() error: %s\n", strerror(errno));
         close(fd);
         return NULL;
     }
 
-    // 6) allocate context + per-client slots
+    // 5a) datagram socket on the same port, if the app handles datagrams
+    int datagramFd = -1;
+    if (clientHandlers_->onDatagram) {
+        datagramFd = server_bind_socket(SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, bind_addr_, port_);
+        if (datagramFd < 0) {
+            close(fd);
+            return NULL;
+        }
+        // report each datagram's local address, so replies can leave from it
+        // even when bound to INADDR_ANY
+        int yes = 1;
+        if (setsockopt(datagramFd, IPPROTO_IP, IP_PKTINFO, &yes, sizeof(yes)) < 0) {
+            fprintf(stderr, "setsockopt(IP_PKTINFO): %s\n", strerror(errno));
+            close(datagramFd);
+            close(fd);
+            return NULL;
+        }
+    }
+
+    // 6) allocate context; client slots are allocated as clients arrive
     server_context_t *ctx = (server_context_t *)calloc(1, sizeof(*ctx));
     ctx->port = port_;
     ctx->serverFd = fd;
+    ctx->datagramFd = datagramFd;
     ctx->maxClients = maxClients_;
     ctx->handlers = *clientHandlers_;
-    ctx->clientContext = (client_context_t **)calloc(maxClients_, sizeof(*ctx->clientContext));
-    for (int i = 0; i < maxClients_; ++i) {
-        ctx->clientContext[i] = (client_context_t *)calloc(1, sizeof(**ctx->clientContext));
-        ctx->clientContext[i]->inUse = false;
-        ctx->clientContext[i]->clientFd = -1;
-        ctx->clientContext[i]->contextData = NULL;
-    }
+    ctx->clientContext = NULL;
+    ctx->clientCapacity = 0;
+    ctx->freeSlot = -1;
+    ctx->eventBatch = SERVER_DEFAULT_EVENT_BATCH;
+    ctx->backend = ServerBackendEpoll;
+    ctx->readBudget = SERVER_DEFAULT_READ_BUDGET;
+    ctx->readyHead = -1;
+    ctx->readyTail = -1;
     return ctx;
 }
 
+//---------------------------------------------------------------------------
+// Shard steering for a SO_REUSEPORT group
+//---------------------------------------------------------------------------
+
+// The program's return value is the index of the socket in the group
+static bool server_attach_reuseport_program(int fd_, struct sock_filter *code_, unsigned short len_) {
+    struct sock_fprog prog = {len_, code_};
+    if (setsockopt(fd_, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0) {
+        fprintf(stderr, "setsockopt(SO_ATTACH_REUSEPORT_CBPF): %s\n", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+bool server_attach_shard_steering(server_context_t **shards_, int shardCount_, bool steerStreams_) {
+    if (shardCount_ < 2) {
+        return true;
+    }
+    if (shards_[0]->datagramFd >= 0) {
+        // datagrams: first byte of the UDP payload
+        struct sock_filter byPayload[] = {
+            BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 0),
+            BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, (uint32_t)shardCount_),
+            BPF_STMT(BPF_RET | BPF_A, 0),
+        };
+        if (!server_attach_reuseport_program(shards_[0]->datagramFd, byPayload, 3)) {
+            return false;
+        }
+    }
+    if (steerStreams_) {
+        // connections: IPv4 source address, read relative to the network header
+        struct sock_filter bySource[] = {
+            BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (uint32_t)(SKF_NET_OFF + 12)),
+            BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, (uint32_t)shardCount_),
+            BPF_STMT(BPF_RET | BPF_A, 0),
+        };
+        if (!server_attach_reuseport_program(shards_[0]->serverFd, bySource, 3)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------
+// Client table
+//---------------------------------------------------------------------------
+
+// Slots allocated the first time a client connects; the table doubles from there
+#define SERVER_INITIAL_CLIENTS 16
+
+// Grow the client table, adding the new slots to the free-list.  Returns false
+// if the table is already at maxClients.
+static bool server_grow_clients(server_context_t *S) {
+    int capacity = S->clientCapacity ? S->clientCapacity * 2 : SERVER_INITIAL_CLIENTS;
+    if (S->maxClients > 0 && capacity > S->maxClients) {
+        capacity = S->maxClients;
+    }
+    if (capacity <= S->clientCapacity) {
+        return false;
+    }
+    client_context_t *slots = (client_context_t *)realloc(S->clientContext, capacity * sizeof(*slots));
+    if (!slots) {
+        return false;
+    }
+    // link the new slots lowest index first
+    for (int i = capacity - 1; i >= S->clientCapacity; --i) {
+        slots[i].inUse = false;
+        slots[i].clientFd = -1;
+        slots[i].contextData = NULL;
+        slots[i].nextFree = S->freeSlot;
+        slots[i].reuses = 0;
+        slots[i].ready = false;
+        slots[i].nextReady = -1;
+        S->freeSlot = i;
+    }
+    S->clientContext = slots;
+    S->clientCapacity = capacity;
+    return true;
+}
+
 //---------------------------------------------------------------------------
 // Epoll helper
 //---------------------------------------------------------------------------
 
-static void epoll_add(int efd, int fd) {
+// epoll_event.data.u64 holds the fd in the high half and one of these tokens,
+// or the client slot index, in the low half
+#define SERVER_TOKEN_LISTEN UINT32_MAX
+#define SERVER_TOKEN_DATAGRAM (UINT32_MAX - 1)
+
+static void epoll_add(int efd, int fd, uint32_t token) {
     struct epoll_event ev = {};
     ev.events = EPOLLIN | EPOLLERR | EPOLLHUP | EPOLLRDHUP | EPOLLET;
-    ev.data.fd = fd;
+    ev.data.u64 = ((uint64_t)(uint32_t)fd << 32) | token;
     if (epoll_ctl(efd, EPOLL_CTL_ADD, fd, &ev) < 0) {
         fprintf(stderr, "epoll_ctl ADD %d: %s\n", fd, strerror(errno));
         exit(1);
@@ -109,92 +233,823 @@ static void epoll_del(int efd, int fd) {
 // On new client connect
 //---------------------------------------------------------------------------
 
-static void server_on_client_connect(server_context_t *S, int efd, int cfd) {
-    for (int i = 0; i < S->maxClients; ++i) {
-        if (!S->clientContext[i]->inUse) {
-            S->clientContext[i]->inUse = true;
-            S->clientContext[i]->clientFd = cfd;
-            S->clientContext[i]->contextData = S->handlers.onConnect(cfd);
+// Give a new connection a slot.  Returns the slot index, or -1 if the server
+// is full (cfd is closed).
+static int server_add_client(server_context_t *S, int cfd) {
+    if (S->freeSlot < 0 && !server_grow_clients(S)) {
+        // no slot free
+        close(cfd);
+        fprintf(stderr, "refused connection: server full\n");
+        return -1;
+    }
+    int idx = S->freeSlot;
+    client_context_t *client = &S->clientContext[idx];
+    S->freeSlot = client->nextFree;
 
-            // non-blocking + keepalive
-            int flags = fcntl(cfd, F_GETFL, 0);
-            fcntl(cfd, F_SETFL, flags | O_NONBLOCK);
+    client->inUse = true;
+    client->clientFd = cfd;
+    client->contextData = S->handlers.onConnect(cfd);
 
-            int ena = 1;
-            setsockopt(cfd, SOL_SOCKET, SO_KEEPALIVE, &ena, sizeof(ena));
+    // keepalive (accept4 already made the socket non-blocking)
+    int ena = 1;
+    setsockopt(cfd, SOL_SOCKET, SO_KEEPALIVE, &ena, sizeof(ena));
 
-            int idleTime = 10;
-            setsockopt(cfd, SOL_TCP, TCP_KEEPIDLE, &idleTime, sizeof(idleTime));
+    int idleTime = 10;
+    setsockopt(cfd, SOL_TCP, TCP_KEEPIDLE, &idleTime, sizeof(idleTime));
 
-            int keepCount = 5;
-            setsockopt(cfd, SOL_TCP, TCP_KEEPCNT, &keepCount, sizeof(keepCount));
+    int keepCount = 5;
+    setsockopt(cfd, SOL_TCP, TCP_KEEPCNT, &keepCount, sizeof(keepCount));
 
-            int keepInterval = 5;
-            setsockopt(cfd, SOL_TCP, TCP_KEEPINTVL, &keepInterval, sizeof(keepInterval));
+    int keepInterval = 5;
+    setsockopt(cfd, SOL_TCP, TCP_KEEPINTVL, &keepInterval, sizeof(keepInterval));
+    return idx;
+}
 
-            epoll_add(efd, cfd);
+static void server_on_client_connect(server_context_t *S, int efd, int cfd) {
+    int idx = server_add_client(S, cfd);
+    if (idx >= 0) {
+        epoll_add(efd, cfd, (uint32_t)idx);
+    }
+}
+
+// Accept every pending connection.  The listener is edge-triggered, so one
+// readiness event may stand for many connections.
+static void server_accept_pending(server_context_t *S, int efd) {
+    while (true) {
+        struct sockaddr_in peer;
+        socklen_t plen = sizeof(peer);
+        int cfd = accept4(S->serverFd, (struct sockaddr *)&peer, &plen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (cfd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                fprintf(stderr, "accept: %s\n", strerror(errno));
+            }
             return;
         }
+        server_on_client_connect(S, efd, cfd);
     }
-    // no slot free
-    close(cfd);
-    fprintf(stderr, "refused connection: server full\n");
 }
 
 //---------------------------------------------------------------------------
 // On client disconnect
 //---------------------------------------------------------------------------
 
+// Close a client and return its slot to the free-list
+static void server_remove_client(server_context_t *S, int idx) {
+    client_context_t *client = &S->clientContext[idx];
+    S->handlers.onDisconnect(client->contextData);
+    close(client->clientFd);
+    client->inUse = false;
+    client->clientFd = -1;
+    client->contextData = NULL;
+    client->nextFree = S->freeSlot;
+    ++client->reuses;
+    S->freeSlot = idx;
+}
+
+//---------------------------------------------------------------------------
+// Ready list: clients with data to read, served round-robin
+//---------------------------------------------------------------------------
+
+static void server_ready_push(server_context_t *S, int idx) {
+    client_context_t *client = &S->clientContext[idx];
+    if (client->ready) {
+        return;
+    }
+    client->ready = true;
+    client->nextReady = -1;
+    if (S->readyTail >= 0) {
+        S->clientContext[S->readyTail].nextReady = idx;
+    } else {
+        S->readyHead = idx;
+    }
+    S->readyTail = idx;
+}
+
+static int server_ready_pop(server_context_t *S) {
+    int idx = S->readyHead;
+    client_context_t *client = &S->clientContext[idx];
+    S->readyHead = client->nextReady;
+    if (S->readyHead < 0) {
+        S->readyTail = -1;
+    }
+    client->ready = false;
+    return idx;
+}
+
+// Unlink a client that is disconnecting; rare, so a walk is fine
+static void server_ready_remove(server_context_t *S, int idx) {
+    if (!S->clientContext[idx].ready) {
+        return;
+    }
+    int prev = -1;
+    for (int i = S->readyHead; i != idx; i = S->clientContext[i].nextReady) {
+        prev = i;
+    }
+    int next = S->clientContext[idx].nextReady;
+    if (prev >= 0) {
+        S->clientContext[prev].nextReady = next;
+    } else {
+        S->readyHead = next;
+    }
+    if (S->readyTail == idx) {
+        S->readyTail = prev;
+    }
+    S->clientContext[idx].ready = false;
+}
+
 static void server_on_client_disconnect(server_context_t *S, int efd, int idx) {
-    S->handlers.onDisconnect(S->clientContext[idx]->contextData);
-    epoll_del(efd, S->clientContext[idx]->clientFd);
-    close(S->clientContext[idx]->clientFd);
-    S->clientContext[idx]->inUse = false;
-    S->clientContext[idx]->clientFd = -1;
+    server_ready_remove(S, idx);
+    epoll_del(efd, S->clientContext[idx].clientFd);
+    server_remove_client(S, idx);
+}
+
+// Give every client that was ready when the round started one read of at most
+// readBudget bytes.  Clients with data left go to the back of the list, so a
+// flooding client costs the others at most one budget per round.
+static void server_read_round(server_context_t *S, int efd) {
+    int last = S->readyTail;
+    while (S->readyHead >= 0) {
+        int idx = server_ready_pop(S);
+        client_context_t *client = &S->clientContext[idx];
+        client_read_result_t result = S->handlers.onReadData(client->clientFd, client->contextData, S->readBudget);
+        if (result == ClientReadPending) {
+            server_ready_push(S, idx);
+        } else if (result == ClientReadClosed) {
+            server_on_client_disconnect(S, efd, idx);
+        }
+        if (idx == last) {
+            break;
+        }
+    }
 }
 
 //---------------------------------------------------------------------------
-// Main loop
+// Main loop (epoll)
 //---------------------------------------------------------------------------
 
-void server_run(server_context_t *S) {
+static void server_run_epoll(server_context_t *S) {
     int efd = epoll_create1(0);
-    epoll_add(efd, S->serverFd);
+    epoll_add(efd, S->serverFd, SERVER_TOKEN_LISTEN);
+    if (S->datagramFd >= 0) {
+        epoll_add(efd, S->datagramFd, SERVER_TOKEN_DATAGRAM);
+    }
+
+    int batch = S->eventBatch > 0 ? S->eventBatch : SERVER_DEFAULT_EVENT_BATCH;
+    struct epoll_event *events = (struct epoll_event *)calloc(batch, sizeof(*events));
 
     while (true) {
-        struct epoll_event ev;
-        int n = epoll_wait(efd, &ev, 1, -1);
+        // clients with data left are served again straight after polling
+        int n = epoll_wait(efd, events, batch, S->readyHead >= 0 ? 0 : -1);
         if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
             fprintf(stderr, "epoll_wait: %s\n", strerror(errno));
             break;
         }
 
-        if (ev.data.fd == S->serverFd) {
-            struct sockaddr_in peer;
-            socklen_t plen = sizeof(peer);
-            int cfd = accept(S->serverFd, (struct sockaddr *)&peer, &plen);
-            if (cfd < 0) {
-                fprintf(stderr, "accept: %s\n", strerror(errno));
-                break;
+        bool acceptPending = false;
+        for (int e = 0; e < n; ++e) {
+            struct epoll_event *ev = &events[e];
+            uint32_t token = (uint32_t)ev->data.u64;
+            int fd = (int)(ev->data.u64 >> 32);
+            if (token == SERVER_TOKEN_LISTEN) {
+                // accepted after the batch, so no slot or fd number freed in
+                // this batch is reused while events for it are still queued
+                acceptPending = true;
+            } else if (token == SERVER_TOKEN_DATAGRAM) {
+                S->handlers.onDatagram(S->datagramFd);
+            } else {
+                // the event carries the slot, so no search; the fd check skips
+                // events for a slot that has since been reused
+                int idx = (int)token;
+                client_context_t *client = &S->clientContext[idx];
+                if (!client->inUse || client->clientFd != fd) {
+                    continue;
+                }
+                if (ev->events & (EPOLLHUP | EPOLLERR)) {
+                    server_on_client_disconnect(S, efd, idx);
+                } else if (ev->events & (EPOLLIN | EPOLLRDHUP)) {
+                    // read in the round below; a half-closed peer reads to EOF there
+                    server_ready_push(S, idx);
+                }
+            }
+        }
+        if (acceptPending) {
+            server_accept_pending(S, efd);
+        }
+        server_read_round(S, efd);
+    }
+    free(events);
+}
+
+//---------------------------------------------------------------------------
+// Main loop (io_uring)
+//
+// The listener takes one multishot accept, and every client one multishot
+// recv filling buffers from a provided buffer ring, so steady-state reads
+// need no submissions at all.  Device writes queued by the handlers (see
+// server_queue_write) are staged in an arena and submitted once per batch of
+// completions, with the writes to each device linked in the order they were
+// queued.  Only one batch is in flight at a time, so ordering holds across
+// batches too.  A short write breaks its device's chain; the rest of it and
+// the writes cancelled after it are submitted again before the next batch.
+//---------------------------------------------------------------------------
+
+#define URING_ENTRIES 256              // submission queue entries
+#define URING_CQ_ENTRIES 4096          // completion queue entries; multishot requests complete often
+#define URING_BUFFERS 512              // provided receive buffers (power of two)
+#define URING_BUFFER_SIZE 4096         // bytes per receive buffer
+#define URING_BUFFER_GROUP 0           // buffer group id of the receive buffers
+#define URING_ARENA_SIZE (256 * 1024)  // bytes of device writes staged per chain
+#define URING_ARENA_WRITES 128         // writes per batch; must fit the submission queue
+
+// user_data: operation in the top byte, slot reuse count in the next 24 bits,
+// slot index in the low half
+enum { UringOpAccept = 1, UringOpRecv, UringOpPoll, UringOpWrite, UringOpCancel, UringOpProbe };
+
+static inline uint64_t uring_user_data(uint64_t op_, uint32_t reuses_, uint32_t idx_) {
+    return (op_ << 56) | ((uint64_t)(reuses_ & 0xffffff) << 32) | idx_;
+}
+
+// A write staged in an arena
+typedef struct {
+    int fd;
+    uint32_t offset; //!< Offset of the data in the arena (advanced past what a short write wrote)
+    uint32_t len;    //!< Bytes still to write
+    int result;      //!< Completion result once submitted; 0 until then
+} uring_write_t;
+
+typedef struct {
+    uint8_t *data;
+    size_t used;
+    uring_write_t writes[URING_ARENA_WRITES];
+    int count;
+} uring_arena_t;
+
+typedef struct {
+    server_context_t *S;
+    int ringFd;
+
+    void *ring; //!< Shared SQ + CQ ring mapping
+    size_t ringSize;
+    uint32_t *sqHead, *sqTail, *sqMask, *sqArray;
+    uint32_t sqEntries;
+    uint32_t sqLocalTail; //!< Tail including SQEs not yet published to the kernel
+    struct io_uring_sqe *sqes;
+    size_t sqesSize;
+    uint32_t *cqHead, *cqTail, *cqMask;
+    struct io_uring_cqe *cqes;
+
+    struct io_uring_buf_ring *bufRing; //!< Provided receive buffers
+    size_t bufRingSize;
+    uint8_t *buffers;
+    uint16_t bufTail;
+
+    struct io_uring_cqe *queue; //!< Completions reaped but not handled yet
+    size_t queueLen, queueCap;
+
+    uring_arena_t arenas[2];
+    int pendingArena;   //!< Arena collecting writes for the next batch; the other belongs to the batch in flight
+    int inflightWrites; //!< Writes of the batch in flight that have not completed
+    bool retryWrites;   //!< Whether the batch in flight had short or cancelled writes
+
+    int probeResult; //!< Result of the multishot probe (see uring_probe)
+    bool probeArmed; //!< Whether the probe recv is still active
+} server_uring_t;
+
+// Ring of the io_uring backend running on this thread, for server_queue_write
+static thread_local server_uring_t *uringCurrent = NULL;
+
+static int uring_setup(unsigned entries_, struct io_uring_params *params_) {
+    return (int)syscall(__NR_io_uring_setup, entries_, params_);
+}
+
+static int uring_register(int fd_, unsigned opcode_, void *arg_, unsigned nrArgs_) {
+    return (int)syscall(__NR_io_uring_register, fd_, opcode_, arg_, nrArgs_);
+}
+
+// Publish queued SQEs, submit them, and wait for minComplete_ completions
+static int uring_enter(server_uring_t *U, unsigned minComplete_) {
+    __atomic_store_n(U->sqTail, U->sqLocalTail, __ATOMIC_RELEASE);
+    while (true) {
+        unsigned toSubmit = U->sqLocalTail - __atomic_load_n(U->sqHead, __ATOMIC_ACQUIRE);
+        int ret = (int)syscall(__NR_io_uring_enter, U->ringFd, toSubmit, minComplete_,
+                               minComplete_ ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        // EBUSY: completions must be reaped before more can be posted
+        return ret < 0 && errno != EBUSY ? -1 : 0;
+    }
+}
+
+static void uring_reap(server_uring_t *U);
+
+// Make room for count_ more SQEs.  Returns false if the ring failed.
+static bool uring_reserve_sqes(server_uring_t *U, uint32_t count_) {
+    while (U->sqEntries - (U->sqLocalTail - __atomic_load_n(U->sqHead, __ATOMIC_ACQUIRE)) < count_) {
+        // queue full: hand what is there to the kernel.  If it took nothing, it
+        // is busy with completions, which are reaped before trying again.
+        if (uring_enter(U, 0) < 0) {
+            fprintf(stderr, "io_uring_enter: %s\n", strerror(errno));
+            return false;
+        }
+        uring_reap(U);
+    }
+    return true;
+}
+
+// Next free SQE, or NULL if the ring failed
+static struct io_uring_sqe *uring_get_sqe(server_uring_t *U) {
+    if (!uring_reserve_sqes(U, 1)) {
+        return NULL;
+    }
+    uint32_t idx = U->sqLocalTail & *U->sqMask;
+    struct io_uring_sqe *sqe = &U->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    U->sqArray[idx] = idx;
+    ++U->sqLocalTail;
+    return sqe;
+}
+
+static void uring_provide_buffer(server_uring_t *U, uint16_t bid_) {
+    // index the ring as a plain array: in C++ the header's flexible bufs member
+    // sits after an empty struct, so it does not start at offset 0
+    struct io_uring_buf *buf = (struct io_uring_buf *)U->bufRing + (U->bufTail & (URING_BUFFERS - 1));
+    buf->addr = (uint64_t)(uintptr_t)(U->buffers + (size_t)bid_ * URING_BUFFER_SIZE);
+    buf->len = URING_BUFFER_SIZE;
+    buf->bid = bid_;
+    ++U->bufTail;
+    __atomic_store_n(&U->bufRing->tail, U->bufTail, __ATOMIC_RELEASE);
+}
+
+static void uring_recycle_buffer(server_uring_t *U, const struct io_uring_cqe *cqe_) {
+    if (cqe_->flags & IORING_CQE_F_BUFFER) {
+        uring_provide_buffer(U, (uint16_t)(cqe_->flags >> IORING_CQE_BUFFER_SHIFT));
+    }
+}
+
+static void uring_arm_accept(server_uring_t *U) {
+    struct io_uring_sqe *sqe = uring_get_sqe(U);
+    if (!sqe) {
+        return;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = U->S->serverFd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = uring_user_data(UringOpAccept, 0, 0);
+}
+
+static void uring_arm_recv(server_uring_t *U, int fd_, uint64_t userData_) {
+    struct io_uring_sqe *sqe = uring_get_sqe(U);
+    if (!sqe) {
+        return;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd_;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->user_data = userData_;
+}
+
+static void uring_arm_poll(server_uring_t *U) {
+    struct io_uring_sqe *sqe = uring_get_sqe(U);
+    if (!sqe) {
+        return;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = U->S->datagramFd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = uring_user_data(UringOpPoll, 0, 0);
+}
+
+static void uring_on_write(server_uring_t *U, const struct io_uring_cqe *cqe_) {
+    uring_write_t *W = &U->arenas[U->pendingArena ^ 1].writes[(uint32_t)cqe_->user_data];
+    W->result = cqe_->res;
+    if (cqe_->res == -ECANCELED || (cqe_->res >= 0 && (uint32_t)cqe_->res < W->len)) {
+        U->retryWrites = true;
+    } else if (cqe_->res < 0) {
+        fprintf(stderr, "device write: %s\n", strerror(-cqe_->res));
+    }
+    --U->inflightWrites;
+}
+
+// Move every completion from the CQ ring to the queue.  Write and probe
+// completions are handled here, so they can be waited for from a handler.
+static void uring_reap(server_uring_t *U) {
+    uint32_t head = *U->cqHead;
+    uint32_t tail = __atomic_load_n(U->cqTail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+        struct io_uring_cqe *cqe = &U->cqes[head & *U->cqMask];
+        uint64_t op = cqe->user_data >> 56;
+        if (op == UringOpWrite) {
+            uring_on_write(U, cqe);
+        } else if (op == UringOpProbe) {
+            U->probeResult = cqe->res;
+            U->probeArmed = (cqe->flags & IORING_CQE_F_MORE) != 0;
+            uring_recycle_buffer(U, cqe);
+        } else if (op != UringOpCancel) {
+            if (U->queueLen == U->queueCap) {
+                U->queueCap = U->queueCap ? U->queueCap * 2 : URING_CQ_ENTRIES;
+                U->queue = (struct io_uring_cqe *)realloc(U->queue, U->queueCap * sizeof(*U->queue));
+            }
+            U->queue[U->queueLen++] = *cqe;
+        }
+    }
+    __atomic_store_n(U->cqHead, head, __ATOMIC_RELEASE);
+}
+
+// Submit the writes of an arena, linking consecutive writes to the same fd
+static bool uring_submit_writes(server_uring_t *U, uring_arena_t *A) {
+    // a chain split across submissions would lose its ordering
+    if (!uring_reserve_sqes(U, (uint32_t)A->count)) {
+        return false;
+    }
+    for (int i = 0; i < A->count; ++i) {
+        struct io_uring_sqe *sqe = uring_get_sqe(U);
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->fd = A->writes[i].fd;
+        sqe->addr = (uint64_t)(uintptr_t)(A->data + A->writes[i].offset);
+        sqe->len = A->writes[i].len;
+        sqe->off = (uint64_t)-1; // devices have no position
+        sqe->flags = i + 1 < A->count && A->writes[i + 1].fd == A->writes[i].fd ? IOSQE_IO_LINK : 0;
+        sqe->user_data = uring_user_data(UringOpWrite, 0, (uint32_t)i);
+        A->writes[i].result = 0;
+    }
+    U->inflightWrites = A->count;
+    return true;
+}
+
+// Keep only the writes of a completed batch that still have to be made: the
+// rest of a short write, and the writes cancelled after it.  Writes cancelled
+// after a failed one are dropped.  Returns the number kept.
+static int uring_retry_writes(uring_arena_t *A) {
+    int kept = 0;
+    bool resume = false; // whether the write before, to the same fd, is being made again
+    for (int i = 0; i < A->count; ++i) {
+        uring_write_t W = A->writes[i];
+        if (i == 0 || W.fd != A->writes[i - 1].fd) {
+            resume = false;
+        }
+        if (W.result == -ECANCELED) {
+            if (!resume) {
+                fprintf(stderr, "device write cancelled after a failed write\n");
+                continue;
+            }
+        } else if (W.result > 0 && (uint32_t)W.result < W.len) {
+            W.offset += (uint32_t)W.result;
+            W.len -= (uint32_t)W.result;
+            resume = true;
+        } else {
+            if (W.result == 0 && W.len > 0) {
+                fprintf(stderr, "device write: nothing written\n");
+            }
+            resume = false;
+            continue;
+        }
+        A->writes[kept++] = W;
+    }
+    A->count = kept;
+    return kept;
+}
+
+// Submit the next batch of writes, if none is in flight: what is left of the
+// batch that completed last, else the pending arena.  Returns false if the
+// ring failed.
+static bool uring_start_writes(server_uring_t *U) {
+    if (U->inflightWrites > 0) {
+        return true;
+    }
+    if (U->retryWrites) {
+        U->retryWrites = false;
+        uring_arena_t *F = &U->arenas[U->pendingArena ^ 1];
+        if (uring_retry_writes(F) > 0) {
+            return uring_submit_writes(U, F);
+        }
+    }
+    uring_arena_t *A = &U->arenas[U->pendingArena];
+    if (A->count == 0) {
+        return true;
+    }
+    // group the writes by fd, keeping their order for each fd, so each device gets one chain
+    for (int i = 1; i < A->count; ++i) {
+        uring_write_t W = A->writes[i];
+        int j = i;
+        for (; j > 0 && A->writes[j - 1].fd > W.fd; --j) {
+            A->writes[j] = A->writes[j - 1];
+        }
+        A->writes[j] = W;
+    }
+    if (!uring_submit_writes(U, A)) {
+        return false;
+    }
+
+    // the other arena's batch has completed, so it is free to collect the next one
+    U->pendingArena ^= 1;
+    U->arenas[U->pendingArena].used = 0;
+    U->arenas[U->pendingArena].count = 0;
+    return true;
+}
+
+// Returns false if the ring failed
+static bool uring_wait_writes(server_uring_t *U) {
+    while (U->inflightWrites > 0) {
+        if (uring_enter(U, 1) < 0) {
+            fprintf(stderr, "io_uring_enter: %s\n", strerror(errno));
+            return false;
+        }
+        uring_reap(U);
+    }
+    return true;
+}
+
+// Complete every write queued so far
+static void uring_drain_writes(server_uring_t *U) {
+    while (U->inflightWrites > 0 || U->retryWrites || U->arenas[U->pendingArena].count > 0) {
+        if (!uring_wait_writes(U) || !uring_start_writes(U)) {
+            return;
+        }
+    }
+}
+
+bool server_queue_write(int fd_, const void *data_, size_t len_) {
+    server_uring_t *U = uringCurrent;
+    if (!U) {
+        return false;
+    }
+    if (len_ > URING_ARENA_SIZE) {
+        // too large to stage; the caller writes it once everything before it is out
+        uring_drain_writes(U);
+        return false;
+    }
+    uring_arena_t *A = &U->arenas[U->pendingArena];
+    // writes are laid out back to back, so consecutive writes to a device merge
+    bool merge = A->count > 0 && A->writes[A->count - 1].fd == fd_;
+    while (A->used + len_ > URING_ARENA_SIZE || (!merge && A->count == URING_ARENA_WRITES)) {
+        // pending arena full: send it as soon as the batch in flight (and anything left of it) completes
+        if (!uring_wait_writes(U) || !uring_start_writes(U)) {
+            return false;
+        }
+        A = &U->arenas[U->pendingArena];
+        merge = false;
+    }
+    memcpy(A->data + A->used, data_, len_);
+    if (merge) {
+        A->writes[A->count - 1].len += (uint32_t)len_;
+    } else {
+        A->writes[A->count].fd = fd_;
+        A->writes[A->count].offset = (uint32_t)A->used;
+        A->writes[A->count].len = (uint32_t)len_;
+        ++A->count;
+    }
+    A->used += len_;
+    return true;
+}
+
+static void uring_destroy(server_uring_t *U) {
+    if (U->ring) {
+        munmap(U->ring, U->ringSize);
+    }
+    if (U->sqes) {
+        munmap(U->sqes, U->sqesSize);
+    }
+    if (U->bufRing) {
+        munmap(U->bufRing, U->bufRingSize);
+    }
+    if (U->ringFd >= 0) {
+        close(U->ringFd);
+    }
+    free(U->buffers);
+    free(U->queue);
+    free(U->arenas[0].data);
+    free(U->arenas[1].data);
+}
+
+// Check that multishot recv with provided buffers works, on a socketpair,
+// before any client depends on it
+static bool uring_probe(server_uring_t *U) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+        return false;
+    }
+    U->probeResult = 0;
+    U->probeArmed = true;
+    uring_arm_recv(U, sv[0], uring_user_data(UringOpProbe, 0, 0));
+    bool ok = write(sv[1], "?", 1) == 1 && uring_enter(U, 1) == 0;
+    uring_reap(U);
+    ok = ok && U->probeResult == 1 && U->probeArmed;
+
+    // end the recv and wait for its final completion
+    shutdown(sv[0], SHUT_RDWR);
+    while (U->probeArmed && uring_enter(U, 1) == 0) {
+        uring_reap(U);
+    }
+    close(sv[0]);
+    close(sv[1]);
+    return ok;
+}
+
+static bool uring_init(server_uring_t *U, server_context_t *S) {
+    memset(U, 0, sizeof(*U));
+    U->S = S;
+    U->ringFd = -1;
+
+    struct io_uring_params params = {};
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = URING_CQ_ENTRIES;
+    U->ringFd = uring_setup(URING_ENTRIES, &params);
+    if (U->ringFd < 0) {
+        fprintf(stderr, "io_uring_setup: %s\n", strerror(errno));
+        return false;
+    }
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        fprintf(stderr, "io_uring: kernel too old\n");
+        return false;
+    }
+
+    // 1) SQ + CQ rings share one mapping; SQEs have their own
+    size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    U->ringSize = sqSize > cqSize ? sqSize : cqSize;
+    void *ring = mmap(NULL, U->ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, U->ringFd,
+                      IORING_OFF_SQ_RING);
+    if (ring == MAP_FAILED) {
+        fprintf(stderr, "io_uring mmap: %s\n", strerror(errno));
+        return false;
+    }
+    U->ring = ring;
+    U->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = mmap(NULL, U->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, U->ringFd,
+                      IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        fprintf(stderr, "io_uring mmap: %s\n", strerror(errno));
+        return false;
+    }
+    U->sqes = (struct io_uring_sqe *)sqes;
+
+    uint8_t *base = (uint8_t *)ring;
+    U->sqHead = (uint32_t *)(base + params.sq_off.head);
+    U->sqTail = (uint32_t *)(base + params.sq_off.tail);
+    U->sqMask = (uint32_t *)(base + params.sq_off.ring_mask);
+    U->sqArray = (uint32_t *)(base + params.sq_off.array);
+    U->sqEntries = params.sq_entries;
+    U->sqLocalTail = *U->sqTail;
+    U->cqHead = (uint32_t *)(base + params.cq_off.head);
+    U->cqTail = (uint32_t *)(base + params.cq_off.tail);
+    U->cqMask = (uint32_t *)(base + params.cq_off.ring_mask);
+    U->cqes = (struct io_uring_cqe *)(base + params.cq_off.cqes);
+
+    // 2) provided receive buffers
+    U->bufRingSize = URING_BUFFERS * sizeof(struct io_uring_buf);
+    void *bufRing = mmap(NULL, U->bufRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (bufRing == MAP_FAILED) {
+        fprintf(stderr, "io_uring buffer ring mmap: %s\n", strerror(errno));
+        return false;
+    }
+    U->bufRing = (struct io_uring_buf_ring *)bufRing;
+    struct io_uring_buf_reg reg = {};
+    reg.ring_addr = (uint64_t)(uintptr_t)bufRing;
+    reg.ring_entries = URING_BUFFERS;
+    reg.bgid = URING_BUFFER_GROUP;
+    if (uring_register(U->ringFd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        fprintf(stderr, "io_uring buffer ring: %s\n", strerror(errno));
+        return false;
+    }
+    U->buffers = (uint8_t *)malloc((size_t)URING_BUFFERS * URING_BUFFER_SIZE);
+    for (uint16_t i = 0; i < URING_BUFFERS; ++i) {
+        uring_provide_buffer(U, i);
+    }
+
+    // 3) write staging
+    U->arenas[0].data = (uint8_t *)malloc(URING_ARENA_SIZE);
+    U->arenas[1].data = (uint8_t *)malloc(URING_ARENA_SIZE);
+
+    if (!uring_probe(U)) {
+        fprintf(stderr, "io_uring: multishot recv not supported\n");
+        return false;
+    }
+    return true;
+}
+
+static void uring_client_disconnect(server_uring_t *U, int idx_) {
+    server_context_t *S = U->S;
+    client_context_t *client = &S->clientContext[idx_];
+
+    // the handler may close fds that queued writes target
+    uring_drain_writes(U);
+
+    // end the client's recv; completions still in flight are told apart by the slot's reuse count
+    struct io_uring_sqe *sqe = uring_get_sqe(U);
+    if (sqe) {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = uring_user_data(UringOpRecv, client->reuses, (uint32_t)idx_);
+        sqe->user_data = uring_user_data(UringOpCancel, 0, 0);
+    }
+    shutdown(client->clientFd, SHUT_RDWR);
+
+    server_remove_client(S, idx_);
+}
+
+static void uring_handle(server_uring_t *U, const struct io_uring_cqe *cqe_) {
+    server_context_t *S = U->S;
+    uint64_t op = cqe_->user_data >> 56;
+    bool more = (cqe_->flags & IORING_CQE_F_MORE) != 0;
+
+    if (op == UringOpAccept) {
+        if (cqe_->res >= 0) {
+            int idx = server_add_client(S, cqe_->res);
+            if (idx >= 0) {
+                uring_arm_recv(U, cqe_->res, uring_user_data(UringOpRecv, S->clientContext[idx].reuses, idx));
             }
-            server_on_client_connect(S, efd, cfd);
         } else {
-            for (int i = 0; i < S->maxClients; ++i) {
-                if (S->clientContext[i]->clientFd == ev.data.fd) {
-                    bool err = false;
-                    if (ev.events & (EPOLLHUP | EPOLLERR | EPOLLRDHUP)) {
-                        err = true;
-                    } else if (ev.events & EPOLLIN) {
-                        if (!S->handlers.onReadData(ev.data.fd, S->clientContext[i]->contextData)) {
-                            err = true;
-                        }
-                    }
-                    if (err) {
-                        server_on_client_disconnect(S, efd, i);
-                    }
-                    break;
+            fprintf(stderr, "accept: %s\n", strerror(-cqe_->res));
+        }
+        if (!more) {
+            uring_arm_accept(U);
+        }
+    } else if (op == UringOpPoll) {
+        S->handlers.onDatagram(S->datagramFd);
+        if (!more) {
+            uring_arm_poll(U);
+        }
+    } else if (op == UringOpRecv) {
+        int idx = (int)(uint32_t)cqe_->user_data;
+        uint32_t reuses = (uint32_t)(cqe_->user_data >> 32) & 0xffffff;
+        client_context_t *client = &S->clientContext[idx];
+        if (client->inUse && (client->reuses & 0xffffff) == reuses) {
+            if (cqe_->res > 0) {
+                uint8_t *data = U->buffers + (size_t)(cqe_->flags >> IORING_CQE_BUFFER_SHIFT) * URING_BUFFER_SIZE;
+                if (!S->handlers.onReceiveData(client->contextData, data, (size_t)cqe_->res)) {
+                    uring_client_disconnect(U, idx);
+                } else if (!more) {
+                    uring_arm_recv(U, client->clientFd, cqe_->user_data);
                 }
+            } else if (cqe_->res == -ENOBUFS) {
+                // every buffer was in use; they are recycled as completions are handled
+                uring_arm_recv(U, client->clientFd, cqe_->user_data);
+            } else {
+                uring_client_disconnect(U, idx);
             }
         }
+        uring_recycle_buffer(U, cqe_);
+    }
+}
+
+// Returns false if io_uring is not usable, before any client was accepted
+static bool server_run_uring(server_context_t *S) {
+    server_uring_t U;
+    if (!uring_init(&U, S)) {
+        uring_destroy(&U);
+        return false;
+    }
+    uringCurrent = &U;
+
+    uring_arm_accept(&U);
+    if (S->datagramFd >= 0) {
+        uring_arm_poll(&U);
+    }
+
+    while (true) {
+        if (uring_enter(&U, 1) < 0) {
+            fprintf(stderr, "io_uring_enter: %s\n", strerror(errno));
+            break;
+        }
+        uring_reap(&U);
+        // handlers may reap more completions onto the queue while waiting for writes
+        for (size_t i = 0; i < U.queueLen; ++i) {
+            struct io_uring_cqe cqe = U.queue[i];
+            uring_handle(&U, &cqe);
+        }
+        U.queueLen = 0;
+        uring_start_writes(&U);
+    }
+
+    uringCurrent = NULL;
+    uring_destroy(&U);
+    return true;
+}
+
+//---------------------------------------------------------------------------
+// Main loop
+//---------------------------------------------------------------------------
+
+void server_run(server_context_t *S) {
+    if (S->backend == ServerBackendUring) {
+        if (!S->handlers.onReceiveData) {
+            fprintf(stderr, "io_uring backend needs onReceiveData; using epoll\n");
+        } else if (server_run_uring(S)) {
+            return;
+        } else {
+            fprintf(stderr, "io_uring backend unavailable; using epoll\n");
+        }
     }
+    server_run_epoll(S);
 }
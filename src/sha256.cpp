@@ -0,0 +1,122 @@
+#include "warpout/sha256.hpp"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+//---------------------------------------------------------------------------
+static const uint32_t sha256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+//---------------------------------------------------------------------------
+static uint32_t sha256_rotr(uint32_t x_, int n_) { return (x_ >> n_) | (x_ << (32 - n_)); }
+
+//---------------------------------------------------------------------------
+static void sha256_compress(uint32_t *state_, const uint8_t *block_) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t)block_[i * 4] << 24 | (uint32_t)block_[i * 4 + 1] << 16 | (uint32_t)block_[i * 4 + 2] << 8 |
+               (uint32_t)block_[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = sha256_rotr(w[i - 15], 7) ^ sha256_rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = sha256_rotr(w[i - 2], 17) ^ sha256_rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state_[0], b = state_[1], c = state_[2], d = state_[3];
+    uint32_t e = state_[4], f = state_[5], g = state_[6], h = state_[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t s1 = sha256_rotr(e, 6) ^ sha256_rotr(e, 11) ^ sha256_rotr(e, 25);
+        uint32_t ch = (e & f) ^ (~e & g);
+        uint32_t t1 = h + s1 + ch + sha256K[i] + w[i];
+        uint32_t s0 = sha256_rotr(a, 2) ^ sha256_rotr(a, 13) ^ sha256_rotr(a, 22);
+        uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = s0 + maj;
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    state_[0] += a;
+    state_[1] += b;
+    state_[2] += c;
+    state_[3] += d;
+    state_[4] += e;
+    state_[5] += f;
+    state_[6] += g;
+    state_[7] += h;
+}
+
+//---------------------------------------------------------------------------
+void sha256_init(sha256_t *ctx_) {
+    static const uint32_t initial[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    memcpy(ctx_->state, initial, sizeof(initial));
+    ctx_->length = 0;
+    ctx_->blockLen = 0;
+}
+
+//---------------------------------------------------------------------------
+void sha256_update(sha256_t *ctx_, const void *data_, size_t len_) {
+    const uint8_t *data = (const uint8_t *)data_;
+    ctx_->length += len_;
+    if (ctx_->blockLen) {
+        size_t n = SHA256_BLOCK_SIZE - ctx_->blockLen;
+        if (n > len_) n = len_;
+        memcpy(ctx_->block + ctx_->blockLen, data, n);
+        ctx_->blockLen += n;
+        data += n;
+        len_ -= n;
+        if (ctx_->blockLen < SHA256_BLOCK_SIZE) return;
+        sha256_compress(ctx_->state, ctx_->block);
+        ctx_->blockLen = 0;
+    }
+    // whole blocks are compressed straight from the input
+    for (; len_ >= SHA256_BLOCK_SIZE; data += SHA256_BLOCK_SIZE, len_ -= SHA256_BLOCK_SIZE)
+        sha256_compress(ctx_->state, data);
+    memcpy(ctx_->block, data, len_);
+    ctx_->blockLen = len_;
+}
+
+//---------------------------------------------------------------------------
+void sha256_final(sha256_t *ctx_, uint8_t *digest_) {
+    uint64_t bits = ctx_->length * 8;
+    ctx_->block[ctx_->blockLen++] = 0x80;
+    if (ctx_->blockLen > SHA256_BLOCK_SIZE - 8) {
+        memset(ctx_->block + ctx_->blockLen, 0, SHA256_BLOCK_SIZE - ctx_->blockLen);
+        sha256_compress(ctx_->state, ctx_->block);
+        ctx_->blockLen = 0;
+    }
+    memset(ctx_->block + ctx_->blockLen, 0, SHA256_BLOCK_SIZE - 8 - ctx_->blockLen);
+    for (int i = 0; i < 8; i++)
+        ctx_->block[SHA256_BLOCK_SIZE - 1 - i] = (uint8_t)(bits >> (i * 8));
+    sha256_compress(ctx_->state, ctx_->block);
+
+    for (int i = 0; i < 8; i++) {
+        digest_[i * 4] = (uint8_t)(ctx_->state[i] >> 24);
+        digest_[i * 4 + 1] = (uint8_t)(ctx_->state[i] >> 16);
+        digest_[i * 4 + 2] = (uint8_t)(ctx_->state[i] >> 8);
+        digest_[i * 4 + 3] = (uint8_t)ctx_->state[i];
+    }
+}
+
+//---------------------------------------------------------------------------
+void sha256(const void *data_, size_t len_, uint8_t *digest_) {
+    sha256_t ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, data_, len_);
+    sha256_final(&ctx, digest_);
+}
@@ -5,6 +5,81 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+//---------------------------------------------------------------------------
+// Scanners returning the offset of the first SLIP_END / SLIP_ESC byte in a
+// buffer, or len_ if there is none.
+typedef size_t (*slip_scan_fn_t)(const uint8_t *buf_, size_t len_);
+
+//---------------------------------------------------------------------------
+static size_t slip_scan_scalar(const uint8_t *buf_, size_t len_) {
+    for (size_t i = 0; i < len_; i++) {
+        if (buf_[i] == SLIP_END || buf_[i] == SLIP_ESC) {
+            return i;
+        }
+    }
+    return len_;
+}
+
+#if defined(__SSE2__)
+//---------------------------------------------------------------------------
+static size_t slip_scan_sse2(const uint8_t *buf_, size_t len_) {
+    const __m128i end = _mm_set1_epi8((char)SLIP_END);
+    const __m128i esc = _mm_set1_epi8((char)SLIP_ESC);
+    size_t i = 0;
+    for (; i + 16 <= len_; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buf_ + i));
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, end), _mm_cmpeq_epi8(v, esc)));
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + slip_scan_scalar(buf_ + i, len_ - i);
+}
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+//---------------------------------------------------------------------------
+__attribute__((target("avx2"))) static size_t slip_scan_avx2(const uint8_t *buf_, size_t len_) {
+    const __m256i end = _mm256_set1_epi8((char)SLIP_END);
+    const __m256i esc = _mm256_set1_epi8((char)SLIP_ESC);
+    size_t i = 0;
+    for (; i + 32 <= len_; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(buf_ + i));
+        unsigned int mask =
+            (unsigned int)(_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, end), _mm256_cmpeq_epi8(v, esc))));
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + slip_scan_scalar(buf_ + i, len_ - i);
+}
+#endif
+
+//---------------------------------------------------------------------------
+static slip_scan_fn_t slip_select_scan(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx2")) {
+        return slip_scan_avx2;
+    }
+#endif
+#if defined(__SSE2__)
+    return slip_scan_sse2;
+#else
+    return slip_scan_scalar;
+#endif
+}
+
+//---------------------------------------------------------------------------
+static size_t slip_find_special(const uint8_t *buf_, size_t len_) {
+    static const slip_scan_fn_t scan = slip_select_scan();
+    return scan(buf_, len_);
+}
 
 //---------------------------------------------------------------------------
 slip_encode_message_t *slip_encode_message_create(size_t rawSize_) {
@@ -67,6 +142,37 @@ slip_encode_return_t slip_encode_byte(slip_encode_message_t *msg_, uint8_t b_) {
     return SlipEncodeOk;
 }
 
+//---------------------------------------------------------------------------
+slip_encode_return_t slip_encode_buffer(slip_encode_message_t *msg_, const void *data_, size_t len_) {
+    const uint8_t *src = (const uint8_t *)(data_);
+
+    while (len_ > 0) {
+        size_t run = slip_find_special(src, len_);
+
+        // bytes that need no escaping go straight into the frame
+        if (run > 0) {
+            if (run > msg_->encodedSize - msg_->index) {
+                return SlipEncodeErrorTooBig;
+            }
+            memcpy(msg_->encoded + msg_->index, src, run);
+            msg_->index += run;
+            src += run;
+            len_ -= run;
+        }
+
+        if (len_ > 0) {
+            if (msg_->encodedSize - msg_->index < 2) {
+                return SlipEncodeErrorTooBig;
+            }
+            msg_->encoded[msg_->index++] = SLIP_ESC;
+            msg_->encoded[msg_->index++] = (*src == SLIP_END) ? SLIP_ESC_END : SLIP_ESC_ESC;
+            src++;
+            len_--;
+        }
+    }
+    return SlipEncodeOk;
+}
+
 //---------------------------------------------------------------------------
 slip_decode_message_t *slip_decode_message_create(size_t rawSize_) {
     slip_decode_message_t *newMessage = (slip_decode_message_t *)(calloc(1, sizeof(slip_decode_message_t)));
@@ -75,6 +181,7 @@ slip_decode_message_t *slip_decode_message_create(size_t rawSize_) {
     newMessage->raw = (uint8_t *)(calloc(1, newMessage->rawSize));
 
     newMessage->inEscape = false;
+    newMessage->discard = false;
     newMessage->index = 0;
 
     return newMessage;
@@ -87,7 +194,10 @@ void slip_decode_message_destroy(slip_decode_message_t *context_) {
 }
 
 //---------------------------------------------------------------------------
-void slip_decode_begin(slip_decode_message_t *msg_) { msg_->index = 0; }
+void slip_decode_begin(slip_decode_message_t *msg_) {
+    msg_->index = 0;
+    msg_->discard = false;
+}
 
 //---------------------------------------------------------------------------
 slip_decode_return_t slip_decode_byte(slip_decode_message_t *msg_, uint8_t b_) {
@@ -132,3 +242,99 @@ slip_decode_return_t slip_decode_byte(slip_decode_message_t *msg_, uint8_t b_) {
     }
     return SlipDecodeOk;
 }
+
+//---------------------------------------------------------------------------
+size_t slip_decode_buffer(slip_decode_message_t *msg_, uint8_t *buf_, size_t len_, slip_frame_t *frames_,
+                          size_t maxFrames_, size_t *consumed_) {
+    // A frame started by a previous call is completed in msg_->raw; every
+    // other frame is compacted in place within buf_.
+    bool carried = (msg_->index > 0) || msg_->inEscape || msg_->discard;
+    uint8_t *out = carried ? msg_->raw : buf_;
+    size_t start = 0;
+    size_t w = carried ? msg_->index : 0;
+    size_t r = 0;
+    size_t count = 0;
+
+    while (r < len_ && count < maxFrames_) {
+        if (msg_->inEscape) {
+            uint8_t b = buf_[r++];
+            msg_->inEscape = false;
+            if (b == SLIP_ESC_END || b == SLIP_ESC_ESC) {
+                b = (b == SLIP_ESC_END) ? SLIP_END : SLIP_ESC;
+                if (out != buf_ && w >= msg_->rawSize) {
+                    msg_->discard = true;
+                } else {
+                    out[w++] = b;
+                }
+                continue;
+            }
+            // invalid escape sequence; drop the frame (b may also terminate it)
+            msg_->discard = true;
+            if (b != SLIP_END) {
+                continue;
+            }
+            r--;
+        }
+
+        // copy the run of ordinary bytes up to the next END / ESC
+        size_t run = slip_find_special(buf_ + r, len_ - r);
+        if (out == buf_) {
+            if (w != r) {
+                memmove(buf_ + w, buf_ + r, run);
+            }
+            w += run;
+        } else if (!msg_->discard) {
+            if (run > msg_->rawSize - w) {
+                msg_->discard = true;
+            } else {
+                memcpy(msg_->raw + w, buf_ + r, run);
+                w += run;
+            }
+        }
+        r += run;
+        if (r == len_) {
+            break;
+        }
+
+        if (buf_[r++] == SLIP_ESC) {
+            msg_->inEscape = true;
+            continue;
+        }
+
+        // SLIP_END: the frame is complete
+        size_t frameLen = w - start;
+        if (!msg_->discard && frameLen > 0 && frameLen <= msg_->rawSize) {
+            frames_[count].data = out + start;
+            frames_[count].len = frameLen;
+            count++;
+        }
+        msg_->discard = false;
+        msg_->index = 0;
+        if (out != buf_) {
+            // return the carried frame alone, so that msg_->raw is not reused
+            // for a new partial frame while the caller still holds the span
+            out = buf_;
+            start = w = r;
+            break;
+        }
+        start = w = r;
+    }
+
+    *consumed_ = r;
+
+    // carry a trailing partial frame over to the next call
+    if (r == len_) {
+        if (out == buf_) {
+            size_t partial = w - start;
+            if (partial > msg_->rawSize) {
+                msg_->discard = true;
+                partial = 0;
+            }
+            memcpy(msg_->raw, buf_ + start, partial);
+            msg_->index = partial;
+        } else {
+            msg_->index = w;
+        }
+    }
+    return count;
+}
@@ -1,40 +1,152 @@
 #include "warpout/tlvc.hpp"
 
+#include <array>
 #include <cstddef>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+//---------------------------------------------------------------------------
+// CRC32C (Castagnoli, reflected polynomial 0x82F63B78).  Uses the SSE4.2 crc32
+// instruction when the CPU has it, and slicing-by-8 tables otherwise.
+//---------------------------------------------------------------------------
+using crc32c_fn_t = uint32_t (*)(uint32_t crc_, const uint8_t *data_, size_t len_);
+
+static constexpr std::array<std::array<uint32_t, 256>, 8> crc32c_make_tables() {
+    std::array<std::array<uint32_t, 256>, 8> tables = {};
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0x82F63B78u : (crc >> 1);
+        }
+        tables[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        for (size_t t = 1; t < 8; t++) {
+            tables[t][i] = (tables[t - 1][i] >> 8) ^ tables[0][tables[t - 1][i] & 0xFF];
+        }
+    }
+    return tables;
+}
+
+static constexpr auto crc32cTables = crc32c_make_tables();
+
+//---------------------------------------------------------------------------
+static uint32_t crc32c_slice8(uint32_t crc_, const uint8_t *data_, size_t len_) {
+    const auto &t = crc32cTables;
+    for (; len_ >= 8; len_ -= 8, data_ += 8) {
+        uint32_t lo, hi;
+        memcpy(&lo, data_, sizeof(lo));
+        memcpy(&hi, data_ + 4, sizeof(hi));
+        lo ^= crc_;
+        crc_ = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+               t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+    }
+    for (; len_ > 0; len_--, data_++) {
+        crc_ = (crc_ >> 8) ^ t[0][(crc_ ^ *data_) & 0xFF];
+    }
+    return crc_;
+}
+
+#if defined(__x86_64__)
+//---------------------------------------------------------------------------
+__attribute__((target("sse4.2"))) static uint32_t crc32c_sse42(uint32_t crc_, const uint8_t *data_, size_t len_) {
+    uint64_t crc = crc_;
+    for (; len_ >= 8; len_ -= 8, data_ += 8) {
+        uint64_t word;
+        memcpy(&word, data_, sizeof(word));
+        crc = _mm_crc32_u64(crc, word);
+    }
+    uint32_t crc32 = (uint32_t)(crc);
+    for (; len_ > 0; len_--, data_++) {
+        crc32 = _mm_crc32_u8(crc32, *data_);
+    }
+    return crc32;
+}
+#endif
+
+//---------------------------------------------------------------------------
+static crc32c_fn_t crc32c_select() {
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2")) {
+        return crc32c_sse42;
+    }
+#endif
+    return crc32c_slice8;
+}
+
+//---------------------------------------------------------------------------
+// Update a running (pre-inverted) CRC32C with more data
+static uint32_t crc32c_update(uint32_t crc_, const void *data_, size_t len_) {
+    static const crc32c_fn_t update = crc32c_select();
+    return update(crc_, reinterpret_cast<const uint8_t *>(data_), len_);
+}
+
+//---------------------------------------------------------------------------
+// Additive 16-bit sum, the original tlvc checksum
+static uint16_t sum16_update(uint16_t sum_, const void *data_, size_t len_) {
+    auto bytes = reinterpret_cast<const uint8_t *>(data_);
+    for (size_t i = 0; i < len_; i++) {
+        sum_ += bytes[i];
+    }
+    return sum_;
+}
+
+//---------------------------------------------------------------------------
+// Compute the checksum of a header and payload that may not be contiguous.
+static uint32_t tlvc_checksum(tlvc_checksum_t checksumType_, const void *header_, const void *payload_,
+                              size_t payloadLen_) {
+    if (checksumType_ == TlvcChecksumCrc32c) {
+        uint32_t crc = crc32c_update(0xFFFFFFFFu, header_, sizeof(tlvc_header_t));
+        crc = crc32c_update(crc, payload_, payloadLen_);
+        return ~crc;
+    }
+    uint16_t sum = sum16_update(0, header_, sizeof(tlvc_header_t));
+    return sum16_update(sum, payload_, payloadLen_);
+}
+
+//---------------------------------------------------------------------------
+size_t tlvc_footer_size(tlvc_checksum_t checksumType_) {
+    return (checksumType_ == TlvcChecksumCrc32c) ? sizeof(uint32_t) : sizeof(uint16_t);
+}
 
 //---------------------------------------------------------------------------
 // Encode TLVC data: fill header, payload pointer+length, and compute footer checksum.
 void tlvc_encode_data(tlvc_data_t *tlvc_, uint16_t tag_, size_t dataLen_, void *data_) {
+    tlvc_encode_data_checksum(tlvc_, tag_, dataLen_, data_, TlvcChecksumSum16);
+}
+
+//---------------------------------------------------------------------------
+void tlvc_encode_data_checksum(tlvc_data_t *tlvc_, uint16_t tag_, size_t dataLen_, void *data_,
+                               tlvc_checksum_t checksumType_) {
     tlvc_->header.tag = tag_;
     tlvc_->header.length = dataLen_;
 
     tlvc_->data = data_;
     tlvc_->dataLen = dataLen_;
+    tlvc_->checksumType = checksumType_;
 
-    // Compute checksum over header bytes
-    uint16_t checksum = 0;
-    auto headerBytes = reinterpret_cast<uint8_t *>(&tlvc_->header);
-    for (size_t i = 0; i < sizeof(tlvc_header_t); i++) {
-        checksum += headerBytes[i];
-    }
-
-    // Compute checksum over payload bytes
-    auto payloadBytes = reinterpret_cast<uint8_t *>(data_);
-    for (size_t i = 0; i < dataLen_; i++) {
-        checksum += payloadBytes[i];
-    }
-
-    tlvc_->footer.checksum = checksum;
+    // Compute checksum over header + payload bytes
+    tlvc_->footer.checksum = tlvc_checksum(checksumType_, &tlvc_->header, data_, dataLen_);
 }
 
 //---------------------------------------------------------------------------
 // Decode raw TLVC blob (header + payload + footer) into tlvc_data_t, with length
 // and checksum checks. Returns true on success, false otherwise.
 bool tlvc_decode_data(tlvc_data_t *tlvc_, void *data_, size_t dataLen_) {
+    return tlvc_decode_data_checksum(tlvc_, data_, dataLen_, TlvcChecksumSum16);
+}
+
+//---------------------------------------------------------------------------
+bool tlvc_decode_data_checksum(tlvc_data_t *tlvc_, void *data_, size_t dataLen_, tlvc_checksum_t checksumType_) {
+    size_t footerSize = tlvc_footer_size(checksumType_);
+
     // Must have at least enough room for header+footer
-    if (dataLen_ < sizeof(tlvc_header_t) + sizeof(tlvc_footer_t)) {
+    if (dataLen_ < sizeof(tlvc_header_t) + footerSize) {
         return false;
     }
 
@@ -43,31 +155,29 @@ bool tlvc_decode_data(tlvc_data_t *tlvc_, void *data_, size_t dataLen_) {
     size_t payloadLen = header->length;
 
     // Check that lengths line up
-    if (sizeof(tlvc_header_t) + payloadLen + sizeof(tlvc_footer_t) != dataLen_) {
+    if (sizeof(tlvc_header_t) + payloadLen + footerSize != dataLen_) {
         return false;
     }
 
     // Compute checksum over header + payload
     auto rawBytes = reinterpret_cast<uint8_t *>(data_);
-    uint16_t checksum = 0;
-    size_t checksumRange = sizeof(tlvc_header_t) + payloadLen;
-    for (size_t i = 0; i < checksumRange; i++) {
-        checksum += rawBytes[i];
-    }
+    uint32_t checksum = tlvc_checksum(checksumType_, rawBytes, rawBytes + sizeof(tlvc_header_t), payloadLen);
 
     // Locate footer immediately after header+payload
-    auto footer = reinterpret_cast<tlvc_footer_t *>(rawBytes + checksumRange);
+    tlvc_footer_t footer = {};
+    memcpy(&footer.checksum, rawBytes + sizeof(tlvc_header_t) + payloadLen, footerSize);
 
     // Verify checksum
-    if (footer->checksum != checksum) {
+    if (footer.checksum != checksum) {
         return false;
     }
 
     // Populate the tlvc_data_t structure
     tlvc_->header = *header;
-    tlvc_->footer = *footer;
+    tlvc_->footer = footer;
     tlvc_->data = rawBytes + sizeof(tlvc_header_t);
     tlvc_->dataLen = payloadLen;
+    tlvc_->checksumType = checksumType_;
 
     return true;
 }
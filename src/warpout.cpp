@@ -1,34 +1,128 @@
 // src/warpout.cpp
 
+#include <algorithm>
 #include <arpa/inet.h>
+#include <cassert>
 #include <cerrno>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <ctime>
+#include <deque>
 #include <fcntl.h>
 #include <iostream>
 #include <linux/input.h>
 #include <linux/uinput.h>
+#include <map>
 #include <memory>
+#include <new>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <string>
 #include <sys/epoll.h>
+#include <sys/random.h>
 #include <sys/socket.h>
+#include <sys/timerfd.h>
 #include <sys/uio.h>
+#include <thread>
 #include <unistd.h>
+#include <unordered_map>
 #include <vector>
 
 #include <CLI/CLI.hpp>
 
+#include "warpout/delta.hpp"
 #include "warpout/joystick.hpp"
 #include "warpout/server.hpp"
+#include "warpout/sha256.hpp"
 #include "warpout/slip.hpp"
 #include "warpout/tlvc.hpp"
 
 //---------------------------------------------------------------------------
 // Shared types for both client & server
 
+// TLVC tags used on the wire
+enum : uint16_t {
+    MsgConfig = 0,      //!< js_config_t describing the device (original protocol)
+    MsgReport = 1,      //!< Full raw report (keyframe)
+    MsgReportDelta = 2, //!< Change mask + changed chunks against the previous report (see delta.hpp)
+    MsgHello = 3,       //!< Client -> server: requested connection settings (hello_t)
+    MsgHelloAck = 4,    //!< Server -> client: accepted connection settings (hello_t)
+    MsgKeyframeAck = 5, //!< Server -> client datagram: keyframe in the header sequence is held (no payload)
+    MsgConfigCompact = 6, //!< Encoded js_compact_config_t describing the device (see js_compact_config_header_t)
+};
+
+// Connection settings negotiated at connect time.  The client sends MsgHello
+// before its config, and waits for MsgHelloAck.  Both are framed with the
+// original settings; everything after the ack uses the settings the server
+// accepted.  Servers that predate the hello never answer, and the client
+// gives up on the connection rather than guess what the server switched to;
+// such servers are only used with --original-protocol, which sends no hello.
+// Fields may only be appended; a missing field takes its original-protocol
+// value.
+//
+// A client sending its config compactly also sends the hash of that encoding.
+// If the server still holds a config with that hash from an earlier
+// connection, it configures the connection from it straight away and says so
+// in the ack, and the client sends no config at all.
+#define PROTOCOL_VERSION 1
+#define HELLO_TIMEOUT_MS 1000
+
+// How TLVC messages are delimited on the stream
+typedef enum : uint8_t {
+    FramingSlip = 0, //!< SLIP-escaped frames (original protocol)
+    FramingLength,   //!< Raw TLVC messages, delimited by the length in their header (reliable streams only)
+} framing_t;
+
+// How reports travel once the config has been sent over the stream
+typedef enum : uint8_t {
+    TransportTcp = 0, //!< Reports follow the config on the TCP stream (original protocol)
+    TransportUdp,     //!< Reports are datagrams to the same port; the stream only carries control
+} transport_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t version;   //!< PROTOCOL_VERSION of the sender
+    uint8_t checksum;   //!< tlvc_checksum_t requested (hello) or accepted (ack)
+    uint8_t framing;    //!< framing_t requested (hello) or accepted (ack)
+    uint8_t transport;  //!< transport_t requested (hello) or accepted (ack)
+    uint32_t sessionId; //!< Ack only: session to put in every datagram header (TransportUdp)
+    uint8_t compactConfig; //!< Non-zero if the config is to be sent as MsgConfigCompact (requested or accepted)
+    uint8_t configHash[SHA256_DIGEST_SIZE]; //!< Hello only: SHA-256 of the MsgConfigCompact payload
+    uint8_t configCached; //!< Ack only: non-zero if the connection is configured from configHash; no config follows
+} hello_t;
+
+static const hello_t helloDefaults = {PROTOCOL_VERSION, TlvcChecksumSum16, FramingSlip, TransportTcp, 0, 0, {}, 0};
+
+// UDP transport.  Every datagram is a datagram_header_t followed by one TLVC
+// message (no SLIP) using the negotiated checksum.  Reports are either a full
+// state (MsgReport) or a delta (MsgReportDelta) against the keyframe whose
+// sequence is in base, which the server has acknowledged.  Full states flagged
+// DatagramKeyframe are retained by the server and acknowledged with
+// MsgKeyframeAck.  The server applies a report only if its sequence is newer
+// than the last one applied, so lost datagrams are never waited for and late
+// ones are dropped.
+enum : uint8_t {
+    DatagramKeyframe = 1, //!< Retain this full state as a delta base, and acknowledge it
+};
+
+typedef struct __attribute__((packed)) {
+    uint32_t sessionId; //!< Session assigned in the hello ack
+    uint32_t sequence;  //!< Incremented for every report; keyframe sequence in acks
+    uint32_t base;      //!< MsgReportDelta: sequence of the keyframe the delta applies to
+    uint8_t flags;      //!< Datagram* flags
+} datagram_header_t;
+
+// Keyframes the server keeps per session as delta bases
+#define DATAGRAM_KEYFRAMES 4
+
+// Largest datagram either side sends
+#define DATAGRAM_MAX 65536
+
+// Largest possible length-framed message
+#define LENGTH_FRAME_MAX (sizeof(tlvc_header_t) + UINT16_MAX + sizeof(tlvc_footer_t))
+
 typedef struct __attribute__((packed)) {
     uint16_t bus;
     uint16_t vid;
@@ -36,145 +130,724 @@ typedef struct __attribute__((packed)) {
     uint16_t version;
 } input_dev_info_t;
 
+// Layout of struct input_absinfo, as filled in by EVIOCGABS
 typedef struct __attribute__((packed)) {
     int32_t value;
     int32_t minimum;
     int32_t maximum;
-    int32_t flat;
     int32_t fuzz;
+    int32_t flat;
+    int32_t resolution;
 } abs_axis_info_t;
 
+// Where each input event lands in the raw report.  One 16-bit slot per code of
+// the types a report carries, sized to the real code ranges so the whole map
+// stays in L1: axis slots are byte offsets of the axis value, button slots are
+// bit offsets of the button.
+#define JS_SLOT_NONE UINT16_MAX
+
 typedef struct {
-    int absAxis[KEY_MAX];
-    int relAxis[KEY_MAX];
-    int buttons[KEY_MAX];
+    uint16_t base[EV_CNT];  //!< Index of each type's first code in slots
+    uint16_t count[EV_CNT]; //!< Codes of each type in slots (0 for the types a report does not carry)
+    uint16_t slots[ABS_CNT + REL_CNT + KEY_CNT];
 } js_index_map_t;
 
+//---------------------------------------------------------------------------
+// Allocation check
+//
+// Debug builds count every operator new, so the client can assert that
+// sending a report never allocates (see report_alloc_check_t).
+
+#ifndef NDEBUG
+static thread_local uint64_t heapAllocations = 0;
+
+// never inlined, where GCC would take the malloc()/free() inside for a new/delete mismatch
+__attribute__((noinline)) void *operator new(std::size_t size) {
+    ++heapAllocations;
+    if (void *p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+#endif
+
 //---------------------------------------------------------------------------
 // SLIP + TLVC encode & transmit helper
 
-static bool encode_and_transmit(int sockFd, uint16_t tag, void *data, size_t len) {
-    tlvc_data_t tlvc = {};
-    tlvc_encode_data(&tlvc, tag, len, data);
+// Fresh sends: poll writable only when nothing is left unsent, in a send buffer
+// just large enough for a few frames in flight
+#define FRESH_NOTSENT_LOWAT 1
+#define FRESH_SNDBUF 4096
+// Fresh sends: whole frames that may queue behind a partly sent one (button
+// changes, which newer state must not replace)
+#define FRESH_CARRY_FRAMES 8
 
-    auto *enc = slip_encode_message_create(len);
-    slip_encode_begin(enc);
+// Per-connection frame transmitter.  The SLIP encoder is sized once for the
+// largest payload the connection will send, so framing never grows it.
+struct frame_tx_t {
+    int sockFd;
+    tlvc_checksum_t checksum; //!< Checksum negotiated for this connection
+    framing_t framing;        //!< Framing negotiated for this connection
+    slip_encode_message_t *enc;
+    size_t maxPayload;    //!< Largest payload enc can frame without growing
+    uint64_t allocations; //!< Encoder buffer allocations made on this connection (calloc, not operator new)
 
-    auto *raw = reinterpret_cast<uint8_t *>(&tlvc.header);
-    for (size_t i = 0; i < sizeof(tlvc.header); ++i)
-        slip_encode_byte(enc, raw[i]);
-    raw = reinterpret_cast<uint8_t *>(tlvc.data);
-    for (size_t i = 0; i < tlvc.dataLen; ++i)
-        slip_encode_byte(enc, raw[i]);
-    raw = reinterpret_cast<uint8_t *>(&tlvc.footer);
-    for (size_t i = 0; i < sizeof(tlvc.footer); ++i)
-        slip_encode_byte(enc, raw[i]);
+    bool fresh;                 //!< Nonblocking sends; see write_or_carry()
+    std::vector<uint8_t> carry; //!< Unsent tail of the last frame, and frames queued behind it (fresh only)
+    size_t carrySent;           //!< Bytes of carry already written
+};
 
-    slip_encode_finish(enc);
+static void frame_tx_reserve(frame_tx_t *tx, size_t maxPayload) {
+    if (tx->enc && maxPayload <= tx->maxPayload) return;
+    if (tx->enc) slip_encode_message_destroy(tx->enc);
+    // SLIP frames header + payload + footer
+    tx->enc = slip_encode_message_create(sizeof(tlvc_header_t) + maxPayload + sizeof(tlvc_footer_t));
+    tx->maxPayload = maxPayload;
+    tx->carry.reserve(tx->enc->encodedSize * FRESH_CARRY_FRAMES);
+    ++tx->allocations;
+}
+
+// Asserts, in debug builds, that nothing is allocated while it is in scope:
+// neither through operator new nor by growing the connection's encoder
+struct report_alloc_check_t {
+#ifndef NDEBUG
+    const frame_tx_t *tx;
+    uint64_t heapBefore;
+    uint64_t encoderBefore;
+
+    explicit report_alloc_check_t(const frame_tx_t *tx_)
+        : tx(tx_), heapBefore(heapAllocations), encoderBefore(tx_->allocations) {}
+    ~report_alloc_check_t() {
+        assert(heapAllocations == heapBefore && "heap allocation while sending a report");
+        assert(tx->allocations == encoderBefore && "encoder grew while sending a report");
+    }
+#else
+    explicit report_alloc_check_t(const frame_tx_t *) {}
+#endif
+};
+
+static void frame_tx_init(frame_tx_t *tx, int sockFd, size_t maxPayload) {
+    *tx = {};
+    tx->sockFd = sockFd;
+    frame_tx_reserve(tx, maxPayload);
+}
+
+static void frame_tx_destroy(frame_tx_t *tx) {
+    if (tx->enc) slip_encode_message_destroy(tx->enc);
+    tx->enc = nullptr;
+}
 
-    int remaining = enc->index;
-    raw = enc->encoded;
-    while (remaining > 0) {
-        int written = write(sockFd, raw, remaining);
-        if (written <= 0 && errno != EINTR && errno != EAGAIN) {
+// Write every iovec in full, resuming after short writes.
+static bool write_all(int fd, iovec *iov, int iovcnt) {
+    while (iovcnt > 0) {
+        ssize_t written = writev(fd, iov, iovcnt);
+        if (written < 0) {
+            if (errno == EINTR || errno == EAGAIN) continue;
             std::perror("socket write");
-            slip_encode_message_destroy(enc);
             return false;
         }
-        if (written > 0) {
-            remaining -= written;
-            raw += written;
+        // drop the vectors written in full, and trim the one written in part
+        while (iovcnt > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            ++iov;
+            --iovcnt;
         }
+        if (iovcnt > 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return true;
+}
+
+// True while part of a frame is still waiting for the socket (fresh only)
+static bool frame_tx_busy(const frame_tx_t *tx) { return tx->carrySent < tx->carry.size(); }
+
+// True if one more frame can queue in tx->carry without growing it (fresh only)
+static bool frame_tx_room(const frame_tx_t *tx) {
+    return tx->carry.capacity() - (tx->carry.size() - tx->carrySent) >= tx->enc->encodedSize;
+}
+
+// Write what the socket takes without blocking, and keep the rest of the frame
+// in tx->carry to be finished by frame_tx_flush() before any other frame.  While
+// a frame is still carried, the next one queues behind it whole.
+static bool write_or_carry(frame_tx_t *tx, iovec *iov, int iovcnt) {
+    ssize_t written = 0;
+    if (frame_tx_busy(tx)) {
+        // drop what has been sent, so the queue stays within the reserved capacity
+        tx->carry.erase(tx->carry.begin(), tx->carry.begin() + tx->carrySent);
+    } else {
+        do {
+            written = writev(tx->sockFd, iov, iovcnt);
+        } while (written < 0 && errno == EINTR);
+        if (written < 0) {
+            if (errno != EAGAIN) {
+                std::perror("socket write");
+                return false;
+            }
+            written = 0;
+        }
+        tx->carry.clear();
+    }
+    tx->carrySent = 0;
+    for (int i = 0; i < iovcnt; ++i) {
+        size_t skip = std::min((size_t)written, iov[i].iov_len);
+        written -= skip;
+        auto *base = (uint8_t *)iov[i].iov_base;
+        tx->carry.insert(tx->carry.end(), base + skip, base + iov[i].iov_len);
+    }
+    return true;
+}
+
+// Write as much of the carried frame as the socket takes without blocking.
+static bool frame_tx_flush(frame_tx_t *tx) {
+    while (frame_tx_busy(tx)) {
+        ssize_t written = write(tx->sockFd, tx->carry.data() + tx->carrySent, tx->carry.size() - tx->carrySent);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) return true;
+            std::perror("socket write");
+            return false;
+        }
+        tx->carrySent += written;
     }
+    return true;
+}
 
-    slip_encode_message_destroy(enc);
+// Switch the connection to nonblocking sends.  Only the newest report should
+// wait for the network, so the kernel is allowed to queue very little: the
+// socket only polls writable once everything written so far has left the
+// host, and a short partial frame is all that is ever carried.
+static bool frame_tx_set_fresh(frame_tx_t *tx) {
+    int one = 1, lowat = FRESH_NOTSENT_LOWAT, sndbuf = FRESH_SNDBUF;
+    if (setsockopt(tx->sockFd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0 ||
+        setsockopt(tx->sockFd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat, sizeof(lowat)) < 0 ||
+        setsockopt(tx->sockFd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)) < 0) {
+        std::perror("setsockopt");
+        return false;
+    }
+    int flags = fcntl(tx->sockFd, F_GETFL);
+    if (flags < 0 || fcntl(tx->sockFd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        std::perror("fcntl");
+        return false;
+    }
+    tx->fresh = true;
     return true;
 }
 
+// In fresh mode the frame is always taken, but may be left partly in
+// tx->carry; callers only send while frame_tx_room() is true.
+static bool encode_and_transmit(frame_tx_t *tx, uint16_t tag, void *data, size_t len) {
+    tlvc_data_t tlvc = {};
+    tlvc_encode_data_checksum(&tlvc, tag, len, data, tx->checksum);
+    size_t footerSize = tlvc_footer_size(tlvc.checksumType);
+
+    if (tx->framing == FramingLength) {
+        // the TLVC header already carries the length; gather header, payload and
+        // footer straight from where they are instead of copying them into a frame
+        iovec iov[3] = {{&tlvc.header, sizeof(tlvc.header)}, {tlvc.data, tlvc.dataLen}, {&tlvc.footer, footerSize}};
+        if (!(tx->fresh ? write_or_carry(tx, iov, 3) : write_all(tx->sockFd, iov, 3))) return false;
+        return true;
+    }
+
+    // only grows (and counts an allocation) if a payload exceeds the initial sizing
+    frame_tx_reserve(tx, len);
+    auto *enc = tx->enc;
+    slip_encode_begin(enc);
+    slip_encode_buffer(enc, &tlvc.header, sizeof(tlvc.header));
+    slip_encode_buffer(enc, tlvc.data, tlvc.dataLen);
+    slip_encode_buffer(enc, &tlvc.footer, footerSize);
+    slip_encode_finish(enc);
+
+    iovec iov = {enc->encoded, enc->index};
+    return tx->fresh ? write_or_carry(tx, &iov, 1) : write_all(tx->sockFd, &iov, 1);
+}
+
+// Send one datagram: header + TLVC message, gathered without copying.  to_ may be
+// null on a connected socket; source, if set, is the local address to send from.
+static bool send_datagram(int fd, const sockaddr_in *to, const in_addr *source, const datagram_header_t *header,
+                          uint16_t tag, void *data, size_t len, tlvc_checksum_t checksum) {
+    tlvc_data_t tlvc = {};
+    tlvc_encode_data_checksum(&tlvc, tag, len, data, checksum);
+    iovec iov[4] = {{(void *)header, sizeof(*header)},
+                    {&tlvc.header, sizeof(tlvc.header)},
+                    {tlvc.data, tlvc.dataLen},
+                    {&tlvc.footer, tlvc_footer_size(checksum)}};
+    msghdr msg = {};
+    msg.msg_name = (void *)to;
+    msg.msg_namelen = to ? sizeof(*to) : 0;
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 4;
+    alignas(cmsghdr) uint8_t control[CMSG_SPACE(sizeof(in_pktinfo))];
+    if (source) {
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = IPPROTO_IP;
+        cmsg->cmsg_type = IP_PKTINFO;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(in_pktinfo));
+        in_pktinfo info = {};
+        info.ipi_spec_dst = *source;
+        std::memcpy(CMSG_DATA(cmsg), &info, sizeof(info));
+    }
+    while (sendmsg(fd, &msg, 0) < 0) {
+        if (errno == EINTR) continue;
+        // a full socket buffer just loses this state; a newer one follows
+        if (errno == EAGAIN || errno == ENOBUFS) return true;
+        std::perror("datagram send");
+        return false;
+    }
+    return true;
+}
+
+// Split a received datagram into its header and TLVC message.
+static bool parse_datagram(uint8_t *buf, size_t len, tlvc_checksum_t checksum, datagram_header_t *header,
+                           tlvc_data_t *tlvc) {
+    if (len < sizeof(*header)) return false;
+    std::memcpy(header, buf, sizeof(*header));
+    return tlvc_decode_data_checksum(tlvc, buf + sizeof(*header), len - sizeof(*header), checksum);
+}
+
 //---------------------------------------------------------------------------
 // js_index_map utilities
 
-static void js_index_map_init(js_index_map_t *m) {
-    for (int i = 0; i < KEY_MAX; ++i)
-        m->absAxis[i] = m->relAxis[i] = m->buttons[i] = -1;
+// Map every code in the configuration to its place in the report laid out for it
+static void js_index_map_init(js_index_map_t *m, const js_compact_config_t *config) {
+    *m = {};
+    m->count[EV_ABS] = ABS_CNT;
+    m->base[EV_REL] = ABS_CNT;
+    m->count[EV_REL] = REL_CNT;
+    m->base[EV_KEY] = ABS_CNT + REL_CNT;
+    m->count[EV_KEY] = KEY_CNT;
+    std::fill(std::begin(m->slots), std::end(m->slots), JS_SLOT_NONE);
+
+    std::vector<uint8_t> raw(joystick_get_report_size(config));
+    js_report_t report;
+    joystick_report_init(&report, config, raw.data());
+    for (int i = 0; i < config->absAxisCount; ++i)
+        m->slots[m->base[EV_ABS] + config->absAxis[i].code] = (uint8_t *)(report.absAxis + i) - raw.data();
+    for (int i = 0; i < config->relAxisCount; ++i)
+        m->slots[m->base[EV_REL] + config->relAxis[i]] = (uint8_t *)(report.relAxis + i) - raw.data();
+    for (int i = 0; i < config->buttonCount; ++i)
+        m->slots[m->base[EV_KEY] + config->buttons[i]] = (report.buttons - raw.data()) * 8 + i;
 }
 
-static void js_index_map_set(js_index_map_t *m, int type, int code, int idx) {
-    if (type == EV_ABS)
-        m->absAxis[code] = idx;
-    else if (type == EV_REL)
-        m->relAxis[code] = idx;
-    else if (type == EV_KEY)
-        m->buttons[code] = idx;
+static inline uint16_t js_index_map_get(const js_index_map_t *m, int type, int code) {
+    if (type >= EV_CNT || code >= m->count[type]) return JS_SLOT_NONE;
+    return m->slots[m->base[type] + code];
 }
 
-static int js_index_map_get(const js_index_map_t *m, int type, int code) {
-    if (type == EV_ABS)
-        return m->absAxis[code];
-    else if (type == EV_REL)
-        return m->relAxis[code];
-    else if (type == EV_KEY)
-        return m->buttons[code];
-    return -1;
+// Relative axes hold the motion since the previous report rather than state,
+// so a report that deltas are taken against or applied to has them at zero:
+// unchanged axes then cost nothing on the wire, and are never re-emitted.
+static void clear_rel_axes(const js_compact_config_t *config, uint8_t *raw) {
+    js_report_t report;
+    joystick_report_init(&report, config, raw);
+    std::memset(report.relAxis, 0, sizeof(int32_t) * config->relAxisCount);
 }
 
-static inline bool is_bit_set(const uint8_t *buf, int bit) { return buf[bit / 8] & (1 << (bit % 8)); }
+// Take the motion a sent report carried out of raw, leaving what has accumulated
+// since (nothing, if the report was raw itself).
+static void subtract_rel_axes(const js_compact_config_t *config, uint8_t *raw, const uint8_t *sent) {
+    js_report_t report, sentReport;
+    joystick_report_init(&report, config, raw);
+    joystick_report_init(&sentReport, config, (uint8_t *)sent);
+    for (int i = 0; i < config->relAxisCount; ++i)
+        report.relAxis[i] -= sentReport.relAxis[i];
+}
 
 //---------------------------------------------------------------------------
 // Client mode
 
-static void run_client(const std::string &device, const std::string &server_addr, uint16_t server_port) {
-    // 1) Open device
-    int fd = open(device.c_str(), O_RDONLY);
-    if (fd < 0) {
-        std::perror(("open " + device).c_str());
-        return;
+struct client_options_t {
+    std::string device;
+    std::string address;
+    uint16_t port;
+    int keyframeInterval;     //!< Send a full report after this many deltas (0 = always full reports)
+    tlvc_checksum_t checksum; //!< Checksum to request for the connection
+    framing_t framing;        //!< Framing to request for the connection
+    transport_t transport;    //!< Transport to request for reports
+    bool fresh;               //!< Never queue reports behind a congested stream (TCP reports only)
+    int maxRate;              //!< Reports sent per second at most (0 = one per EV_SYN)
+    int latencyBudgetMs;      //!< Longest the rate limit may hold back a button change
+    bool originalProtocol;    //!< Send no hello and the full js_config_t, for servers that predate the hello
+};
+
+// Wait for a frame with the given tag, and copy its payload to out.
+static bool receive_frame(int sock, tlvc_checksum_t checksum, uint16_t tag, void *out, size_t outLen, int timeoutMs) {
+    auto *dec = slip_decode_message_create(256);
+    bool received = false;
+    while (!received) {
+        pollfd pfd = {sock, POLLIN, 0};
+        if (poll(&pfd, 1, timeoutMs) <= 0) break;
+        uint8_t buf[256];
+        ssize_t rd = read(sock, buf, sizeof(buf));
+        if (rd <= 0) break;
+        size_t offset = 0;
+        while (offset < (size_t)rd && !received) {
+            slip_frame_t frame;
+            size_t consumed = 0;
+            if (slip_decode_buffer(dec, buf + offset, rd - offset, &frame, 1, &consumed) == 1) {
+                tlvc_data_t tlvc;
+                if (tlvc_decode_data_checksum(&tlvc, frame.data, frame.len, checksum) && tlvc.header.tag == tag) {
+                    std::memcpy(out, tlvc.data, std::min(outLen, tlvc.dataLen));
+                    received = true;
+                }
+            }
+            offset += consumed;
+        }
+    }
+    slip_decode_message_destroy(dec);
+    return received;
+}
+
+// Agree on the connection settings with the server (see hello_t).  ack
+// receives the accepted settings.  Unless told the server predates the hello,
+// there is always something to negotiate, as the client always asks to send
+// its config compactly, and offers its hash.
+static bool negotiate(frame_tx_t *ftx, const client_options_t &options, const uint8_t *configHash, hello_t *ack) {
+    *ack = helloDefaults;
+    if (options.originalProtocol) return true;
+    hello_t hello = helloDefaults;
+    hello.checksum = options.checksum;
+    hello.framing = options.framing;
+    hello.transport = options.transport;
+    hello.compactConfig = 1;
+    std::memcpy(hello.configHash, configHash, sizeof(hello.configHash));
+    if (!encode_and_transmit(ftx, MsgHello, &hello, sizeof(hello))) return false;
+
+    if (!receive_frame(ftx->sockFd, ftx->checksum, MsgHelloAck, ack, sizeof(*ack), HELLO_TIMEOUT_MS)) {
+        // an ack may still be on its way, so the server's settings are unknown
+        std::puts("no hello ack from server (use --original-protocol for servers that predate it)");
+        return false;
     }
+    ftx->checksum = (tlvc_checksum_t)ack->checksum;
+    ftx->framing = (framing_t)ack->framing;
+    if (ack->transport == TransportUdp && ack->sessionId == 0) ack->transport = TransportTcp;
+    return true;
+}
 
-    // 2) Build index map + config
-    auto indexMap = std::make_unique<js_index_map_t>();
-    js_index_map_init(indexMap.get());
-    js_config_t config = {};
+// Send the device configuration; compactly (as encoded), unless the server only knows js_config_t
+static bool transmit_config(frame_tx_t *ftx, const js_compact_config_t *config, const std::vector<uint8_t> &encoded,
+                            bool compact) {
+    if (compact) return encode_and_transmit(ftx, MsgConfigCompact, (void *)encoded.data(), encoded.size());
+    auto full = std::make_unique<js_config_t>();
+    joystick_config_to_full(config, full.get());
+    return encode_and_transmit(ftx, MsgConfig, full.get(), sizeof(*full));
+}
 
-    // 2a) Get device info
-    input_dev_info_t info = {};
-    ioctl(fd, EVIOCGID, &info);
-    config.pid = info.pid;
-    config.vid = info.vid;
+// Per-connection transmit state for reports
+struct report_tx_t {
+    std::vector<uint8_t> sent;  //!< Last report transmitted, i.e. what the server holds (motion cleared)
+    std::vector<uint8_t> delta; //!< Scratch buffer for delta payloads
+    int sinceKeyframe;          //!< Deltas sent since the last full report
+    const js_compact_config_t *config; //!< Layout of the reports
+};
 
-    // 2b) Get device name
-    char name[256] = {};
-    ioctl(fd, EVIOCGNAME(sizeof(name)), name);
-    strncpy(config.name, name, sizeof(config.name));
-
-    // 2c) Query supported events
-    uint8_t bits[EV_MAX][(KEY_MAX + 7) / 8] = {};
-    ioctl(fd, EVIOCGBIT(0, EV_MAX), bits[0]);
-    for (int t = 0; t < EV_MAX; ++t) {
-        if (t == EV_SYN || !is_bit_set(bits[0], t)) continue;
-        ioctl(fd, EVIOCGBIT(t, KEY_MAX), bits[t]);
-        for (int c = 0; c < KEY_MAX; ++c) {
-            if (!is_bit_set(bits[t], c)) continue;
-            if (t == EV_ABS) {
-                abs_axis_info_t ai = {};
-                ioctl(fd, EVIOCGABS(c), &ai);
-                js_index_map_set(indexMap.get(), t, c, config.absAxisCount);
-                config.absAxis[config.absAxisCount] = c;
-                config.absAxisMin[config.absAxisCount] = ai.minimum;
-                config.absAxisMax[config.absAxisCount] = ai.maximum;
-                config.absAxisFuzz[config.absAxisCount] = ai.fuzz;
-                config.absAxisFlat[config.absAxisCount] = ai.flat;
-                config.absAxisResolution[config.absAxisCount] = 0;
-                ++config.absAxisCount;
-            } else if (t == EV_REL) {
-                js_index_map_set(indexMap.get(), t, c, config.relAxisCount);
-                config.relAxis[config.relAxisCount++] = c;
-            } else if (t == EV_KEY) {
-                js_index_map_set(indexMap.get(), t, c, config.buttonCount);
-                config.buttons[config.buttonCount++] = c;
+// Send the current report either as a delta against the last one sent, or as a
+// full keyframe when one is due (or the delta would not be any smaller).
+static bool transmit_report(frame_tx_t *ftx, const client_options_t &options, report_tx_t *tx,
+                            std::vector<uint8_t> &report) {
+    size_t reportSize = report.size();
+    if (tx->sinceKeyframe < options.keyframeInterval) {
+        size_t len = delta_encode(tx->sent.data(), report.data(), reportSize, tx->delta.data());
+        if (len < reportSize) {
+            if (!encode_and_transmit(ftx, MsgReportDelta, tx->delta.data(), len)) return false;
+            ++tx->sinceKeyframe;
+            tx->sent = report;
+            clear_rel_axes(tx->config, tx->sent.data());
+            return true;
+        }
+    }
+    if (!encode_and_transmit(ftx, MsgReport, report.data(), reportSize)) return false;
+    tx->sinceKeyframe = 0;
+    tx->sent = report;
+    clear_rel_axes(tx->config, tx->sent.data());
+    return true;
+}
+
+// Per-session transmit state for reports sent as datagrams (TransportUdp)
+struct datagram_tx_t {
+    int fd;                   //!< UDP socket connected to the server
+    uint32_t sessionId;       //!< Session assigned in the hello ack
+    tlvc_checksum_t checksum; //!< Checksum negotiated for the connection
+    uint32_t sequence;        //!< Sequence of the last report sent
+
+    std::vector<uint8_t> candidate; //!< Keyframe sent but not acknowledged yet
+    uint32_t candidateSeq;
+    bool haveCandidate;
+
+    std::vector<uint8_t> acked; //!< Newest keyframe the server acknowledged (motion cleared); deltas apply to it
+    uint32_t ackedSeq;
+    bool haveAcked;
+
+    std::vector<uint8_t> delta; //!< Scratch buffer for delta payloads
+    const js_compact_config_t *config; //!< Layout of the reports
+};
+
+// Send the current report as a datagram.  Deltas are only ever taken against a
+// keyframe the server has acknowledged, so any single datagram is enough to
+// reconstruct the state no matter which earlier ones were lost.
+static bool transmit_datagram_report(datagram_tx_t *tx, const client_options_t &options, std::vector<uint8_t> &report) {
+    size_t reportSize = report.size();
+    uint32_t seq = ++tx->sequence;
+    datagram_header_t header = {tx->sessionId, seq, 0, 0};
+
+    if (options.keyframeInterval > 0) {
+        uint32_t interval = options.keyframeInterval;
+        // an unacknowledged keyframe is resent after an interval, in case it or its ack was lost
+        bool due = tx->haveCandidate ? seq - tx->candidateSeq >= interval
+                                     : !tx->haveAcked || seq - tx->ackedSeq >= interval;
+        if (due) {
+            header.flags = DatagramKeyframe;
+            tx->candidate = report;
+            clear_rel_axes(tx->config, tx->candidate.data());
+            tx->candidateSeq = seq;
+            tx->haveCandidate = true;
+            return send_datagram(tx->fd, nullptr, nullptr, &header, MsgReport, report.data(), reportSize, tx->checksum);
+        }
+        if (tx->haveAcked) {
+            size_t len = delta_encode(tx->acked.data(), report.data(), reportSize, tx->delta.data());
+            if (len < reportSize) {
+                header.base = tx->ackedSeq;
+                return send_datagram(tx->fd, nullptr, nullptr, &header, MsgReportDelta, tx->delta.data(), len, tx->checksum);
             }
         }
     }
+    return send_datagram(tx->fd, nullptr, nullptr, &header, MsgReport, report.data(), reportSize, tx->checksum);
+}
+
+// Drain keyframe acks from the server.  Returns false once the server is
+// known to be gone (its port refuses datagrams).
+static bool receive_datagram_acks(datagram_tx_t *tx) {
+    uint8_t buf[256];
+    ssize_t rd;
+    while ((rd = recv(tx->fd, buf, sizeof(buf), MSG_DONTWAIT)) >= 0) {
+        datagram_header_t header;
+        tlvc_data_t tlvc;
+        if (!parse_datagram(buf, rd, tx->checksum, &header, &tlvc) || header.sessionId != tx->sessionId ||
+            tlvc.header.tag != MsgKeyframeAck)
+            continue;
+        if (tx->haveCandidate && header.sequence == tx->candidateSeq) {
+            std::swap(tx->acked, tx->candidate);
+            tx->ackedSeq = tx->candidateSeq;
+            tx->haveAcked = true;
+            tx->haveCandidate = false;
+        }
+    }
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return true;
+    std::perror("datagram receive");
+    return false;
+}
+
+//---------------------------------------------------------------------------
+// Device probing
+
+#define BITS_PER_LONG (8 * sizeof(unsigned long))
+#define BITMAP_LONGS(bits) (((bits) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+
+// Everything the client learns by probing a device, kept across reconnects
+struct device_probe_t {
+    std::string path;
+    input_dev_info_t id;
+    char uniq[64]; //!< EVIOCGUNIQ, e.g. a serial number (empty if the device has none)
+    js_compact_config_t *config;
+    std::vector<uint8_t> encodedConfig;     //!< config as sent in MsgConfigCompact
+    uint8_t configHash[SHA256_DIGEST_SIZE]; //!< SHA-256 of encodedConfig, offered in the hello
+    js_index_map_t indexMap;
+
+    ~device_probe_t() { joystick_config_destroy(config); }
+};
+
+// The device probed last; reconnecting to the same device skips the probe
+static std::unique_ptr<device_probe_t> probeCache;
+
+// Collect the codes below codeCount of one event type the device supports, in ascending order.
+// evdev bitmaps are arrays of longs, so they are walked a word at a time,
+// jumping straight from one set bit to the next.
+static int read_capabilities(int fd, int type, int codeCount, int *codes) {
+    unsigned long bits[BITMAP_LONGS(KEY_CNT)] = {};
+    if (ioctl(fd, EVIOCGBIT(type, BITMAP_LONGS(codeCount) * sizeof(long)), bits) < 0) return 0;
+    int count = 0;
+    for (size_t w = 0; w < BITMAP_LONGS(codeCount); ++w) {
+        for (unsigned long word = bits[w]; word != 0; word &= word - 1) {
+            int code = (int)(w * BITS_PER_LONG) + __builtin_ctzl(word);
+            if (code >= codeCount) break;
+            codes[count++] = code;
+        }
+    }
+    return count;
+}
+
+// Build the configuration and index map for the device (identified in probe)
+static bool probe_device(int fd, device_probe_t *probe) {
+    // only the types a report carries are queried; an unsupported type has no bits set
+    int absCodes[ABS_CNT], relCodes[REL_CNT], keyCodes[KEY_CNT];
+    int absCount = read_capabilities(fd, EV_ABS, ABS_CNT, absCodes);
+    int relCount = read_capabilities(fd, EV_REL, REL_CNT, relCodes);
+    int keyCount = read_capabilities(fd, EV_KEY, KEY_CNT, keyCodes);
+
+    char name[256] = {};
+    ioctl(fd, EVIOCGNAME(sizeof(name) - 1), name);
+    auto *config = joystick_config_create(absCount, relCount, keyCount, strlen(name));
+    if (!config) return false;
+    std::memcpy(config->name, name, strlen(name));
+    config->pid = probe->id.pid;
+    config->vid = probe->id.vid;
+
+    for (int i = 0; i < absCount; ++i) {
+        abs_axis_info_t ai = {};
+        ioctl(fd, EVIOCGABS(absCodes[i]), &ai);
+        config->absAxis[i] = {(uint16_t)absCodes[i], ai.minimum, ai.maximum, ai.fuzz, ai.flat, ai.resolution};
+    }
+    for (int i = 0; i < relCount; ++i)
+        config->relAxis[i] = relCodes[i];
+    for (int i = 0; i < keyCount; ++i)
+        config->buttons[i] = keyCodes[i];
+    probe->config = config;
+    probe->encodedConfig.resize(joystick_config_encoded_size(config));
+    joystick_config_encode(config, probe->encodedConfig.data());
+    sha256(probe->encodedConfig.data(), probe->encodedConfig.size(), probe->configHash);
+    js_index_map_init(&probe->indexMap, config);
+    return true;
+}
+
+// Have the kernel deliver only the events a report carries, plus EV_SYN.
+// Everything else (EV_MSC scan codes before each key, LEDs, ...) would only
+// cost a wakeup and a copy before being discarded.  Kernels without
+// EVIOCSMASK simply keep delivering everything.
+static void filter_device_events(int fd, const js_compact_config_t *config) {
+    // the types evdev keeps a mask for, other than EV_SYN
+    static const int maskable[] = {EV_KEY, EV_REL, EV_ABS, EV_MSC, EV_SW, EV_LED, EV_SND, EV_FF};
+    for (int type : maskable) {
+        unsigned long codes[BITMAP_LONGS(KEY_CNT)] = {};
+        int wantedCount = type == EV_ABS   ? config->absAxisCount
+                          : type == EV_REL ? config->relAxisCount
+                          : type == EV_KEY ? config->buttonCount
+                                           : 0;
+        for (int i = 0; i < wantedCount; ++i) {
+            unsigned code = type == EV_ABS   ? config->absAxis[i].code
+                            : type == EV_REL ? config->relAxis[i]
+                                             : config->buttons[i];
+            codes[code / BITS_PER_LONG] |= 1ul << (code % BITS_PER_LONG);
+        }
+        input_mask mask = {(uint32_t)type, (uint32_t)sizeof(codes), (uint64_t)(uintptr_t)codes};
+        ioctl(fd, EVIOCSMASK, &mask);
+    }
+}
+
+// Report pacing (--max-rate).  A report waits for its slot, and newer state
+// replaces it meanwhile; a button change waits at most budgetNs, and is never
+// replaced by another button change before it has gone out.
+struct report_pacer_t {
+    int timerFd;         //!< Fires at deadlineNs (-1 = reports are not paced)
+    uint64_t intervalNs; //!< Minimum time between reports
+    uint64_t budgetNs;   //!< Longest a button change may wait
+    uint64_t lastSentNs; //!< When the last report went out
+    uint64_t deadlineNs; //!< When the pending report is due (0 = none pending)
+    bool edgePending;    //!< The pending report carries a button change
+};
+
+static uint64_t monotonic_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static bool pacer_init(report_pacer_t *p, const client_options_t &options) {
+    *p = {};
+    p->timerFd = -1;
+    if (options.maxRate <= 0) return true;
+    p->timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (p->timerFd < 0) {
+        std::perror("timerfd_create");
+        return false;
+    }
+    p->intervalNs = 1000000000ull / options.maxRate;
+    p->budgetNs = (uint64_t)options.latencyBudgetMs * 1000000ull;
+    return true;
+}
+
+// A report is complete (EV_SYN) at now; edge if it changes a button.  Returns
+// true if it is due right away; otherwise the timer is armed for when it is.
+static bool pacer_sync(report_pacer_t *p, uint64_t now, bool edge) {
+    uint64_t due = p->lastSentNs + p->intervalNs;
+    if (edge) {
+        due = std::min(due, now + p->budgetNs);
+        p->edgePending = true;
+    }
+    if (p->deadlineNs != 0) due = std::min(due, p->deadlineNs);
+    if (due <= now) return true;
+    if (due != p->deadlineNs) {
+        itimerspec when = {};
+        when.it_value.tv_sec = due / 1000000000ull;
+        when.it_value.tv_nsec = due % 1000000000ull;
+        timerfd_settime(p->timerFd, TFD_TIMER_ABSTIME, &when, nullptr);
+        p->deadlineNs = due;
+    }
+    return false;
+}
+
+// The timer fired; returns true if the pending report is now due.
+static bool pacer_expired(report_pacer_t *p, uint64_t now) {
+    uint64_t expirations;
+    while (read(p->timerFd, &expirations, sizeof(expirations)) > 0) {}
+    return p->deadlineNs != 0 && p->deadlineNs <= now;
+}
+
+static void pacer_sent(report_pacer_t *p, uint64_t now) {
+    if (p->deadlineNs > now) {
+        // sent ahead of the timer, which has nothing left to wake us for
+        itimerspec off = {};
+        timerfd_settime(p->timerFd, 0, &off, nullptr);
+    }
+    p->lastSentNs = now;
+    p->deadlineNs = 0;
+    p->edgePending = false;
+}
+
+// Event loop tokens for the client's descriptors
+enum { ClientWatchDevice, ClientWatchDatagram, ClientWatchStream, ClientWatchPacer };
+
+static bool client_watch(int efd, int op, int fd, uint32_t events, uint32_t token) {
+    epoll_event ev = {};
+    ev.events = events;
+    ev.data.u32 = token;
+    if (epoll_ctl(efd, op, fd, &ev) == 0) return true;
+    std::perror("epoll_ctl");
+    return false;
+}
+
+static void run_client(const client_options_t &options) {
+    // 1) Open device
+    int fd = open(options.device.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::perror(("open " + options.device).c_str());
+        return;
+    }
+
+    // 2) Build index map + config, unless this is the device probed last time
+    input_dev_info_t id = {};
+    char uniq[sizeof(device_probe_t::uniq)] = {};
+    ioctl(fd, EVIOCGID, &id);
+    ioctl(fd, EVIOCGUNIQ(sizeof(uniq) - 1), uniq);
+    if (!probeCache || probeCache->path != options.device || std::memcmp(&probeCache->id, &id, sizeof(id)) != 0 ||
+        std::strcmp(probeCache->uniq, uniq) != 0) {
+        auto probe = std::make_unique<device_probe_t>();
+        probe->path = options.device;
+        probe->id = id;
+        std::memcpy(probe->uniq, uniq, sizeof(uniq));
+        if (!probe_device(fd, probe.get())) {
+            std::puts("device probe failed");
+            close(fd);
+            return;
+        }
+        probeCache = std::move(probe);
+    }
+    const js_compact_config_t *config = probeCache->config;
+    const js_index_map_t *indexMap = &probeCache->indexMap;
+    filter_device_events(fd, config);
 
     // 3) Connect to server
     int sock = socket(AF_INET, SOCK_STREAM, 0);
@@ -185,8 +858,8 @@ static void run_client(const std::string &device, const std::string &server_addr
     }
     sockaddr_in addr = {};
     addr.sin_family = AF_INET;
-    inet_pton(AF_INET, server_addr.c_str(), &addr.sin_addr);
-    addr.sin_port = htons(server_port);
+    inet_pton(AF_INET, options.address.c_str(), &addr.sin_addr);
+    addr.sin_port = htons(options.port);
     if (connect(sock, (sockaddr *)&addr, sizeof(addr)) < 0) {
         std::perror("connect");
         close(sock);
@@ -194,23 +867,150 @@ static void run_client(const std::string &device, const std::string &server_addr
         return;
     }
 
-    // 4) Send configuration
-    if (!encode_and_transmit(sock, 0, &config, sizeof(config))) {
+    // 4) Size the encoder once for everything this connection sends, then send configuration
+    size_t reportSize = joystick_get_report_size(config);
+    frame_tx_t ftx;
+    frame_tx_init(&ftx, sock, std::max(sizeof(js_config_t), delta_max_size(reportSize)));
+    hello_t accepted;
+    if (!negotiate(&ftx, options, probeCache->configHash, &accepted) ||
+        (!accepted.configCached &&
+         !transmit_config(&ftx, config, probeCache->encodedConfig, accepted.compactConfig))) {
+        frame_tx_destroy(&ftx);
+        close(sock);
+        close(fd);
+        return;
+    }
+
+    // 4a) Reports go as datagrams to the same address if the server accepted UDP
+    datagram_tx_t dtx = {};
+    dtx.fd = -1;
+    if (accepted.transport == TransportUdp) {
+        dtx.fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        if (dtx.fd < 0 || connect(dtx.fd, (sockaddr *)&addr, sizeof(addr)) < 0) {
+            std::perror("datagram socket");
+            if (dtx.fd >= 0) close(dtx.fd);
+            frame_tx_destroy(&ftx);
+            close(sock);
+            close(fd);
+            return;
+        }
+        dtx.sessionId = accepted.sessionId;
+        dtx.checksum = ftx.checksum;
+        dtx.candidate.resize(reportSize);
+        dtx.acked.resize(reportSize);
+        dtx.delta.resize(delta_max_size(reportSize));
+        dtx.config = config;
+        std::printf("sending reports over UDP, session %08x\n", dtx.sessionId);
+    } else if (options.fresh && !frame_tx_set_fresh(&ftx)) {
+        frame_tx_destroy(&ftx);
         close(sock);
         close(fd);
         return;
     }
 
     // 5) Prepare report buffer
-    size_t reportSize = joystick_get_report_size(&config);
     std::vector<uint8_t> rawReport(reportSize);
-    js_report_t report;
-    report.absAxis = reinterpret_cast<int32_t *>(rawReport.data());
-    report.relAxis = reinterpret_cast<int32_t *>(rawReport.data() + sizeof(int32_t) * config.absAxisCount);
-    report.buttons = rawReport.data() + sizeof(int32_t) * (config.absAxisCount + config.relAxisCount);
+    uint8_t *raw = rawReport.data();
+    // paced: rawReport as of the last EV_SYN, while a button change waits in it
+    std::vector<uint8_t> syncedReport(reportSize);
+
+    // The first report is always a keyframe
+    report_tx_t tx = {std::vector<uint8_t>(reportSize), std::vector<uint8_t>(delta_max_size(reportSize)),
+                      options.keyframeInterval, config};
+    bool reportPending = false; // fresh: rawReport is newer than anything handed to the socket
+    bool watchOut = false;      // fresh: waiting for the socket to drain
+    bool frameEdge = false;     // a button changed since the last EV_SYN
+
+    report_pacer_t pacer;
+    int efd = -1;
+
+    // Hand a report to the transport; fresh streams send rawReport once they
+    // drain, unless it must go out now and there is room to queue it behind the
+    // last one.  Relative axes accumulate in rawReport until a report carries
+    // them, then restart from what has accumulated since.
+    auto transmit = [&](std::vector<uint8_t> &report) {
+        report_alloc_check_t check(&ftx);
+        bool sent = dtx.fd >= 0 ? transmit_datagram_report(&dtx, options, report)
+                                : transmit_report(&ftx, options, &tx, report);
+        subtract_rel_axes(config, raw, report.data());
+        return sent;
+    };
+    auto release = [&](bool now, std::vector<uint8_t> &report) {
+        if (pacer.timerFd >= 0) pacer_sent(&pacer, monotonic_ns());
+        reportPending = ftx.fresh && (!now || !frame_tx_room(&ftx));
+        return reportPending || transmit(report);
+    };
+    if (!pacer_init(&pacer, options)) goto cleanup;
+
+    // 6) Event loop.  With nothing but the device to wait for, reads simply block.
+    if (dtx.fd >= 0 || ftx.fresh || pacer.timerFd >= 0) {
+        efd = epoll_create1(EPOLL_CLOEXEC);
+        if (efd < 0) {
+            std::perror("epoll_create1");
+            goto cleanup;
+        }
+        if (!client_watch(efd, EPOLL_CTL_ADD, fd, EPOLLIN, ClientWatchDevice)) goto cleanup;
+        if (dtx.fd >= 0 && (!client_watch(efd, EPOLL_CTL_ADD, dtx.fd, EPOLLIN, ClientWatchDatagram) ||
+                            !client_watch(efd, EPOLL_CTL_ADD, sock, EPOLLIN, ClientWatchStream)))
+            goto cleanup;
+        if (ftx.fresh && !client_watch(efd, EPOLL_CTL_ADD, sock, 0, ClientWatchStream)) goto cleanup;
+        if (pacer.timerFd >= 0 && !client_watch(efd, EPOLL_CTL_ADD, pacer.timerFd, EPOLLIN, ClientWatchPacer))
+            goto cleanup;
+    }
 
-    // 6) Event loop
     while (true) {
+        if (efd >= 0) {
+            if (ftx.fresh && watchOut != (reportPending || frame_tx_busy(&ftx))) {
+                watchOut = !watchOut;
+                if (!client_watch(efd, EPOLL_CTL_MOD, sock, watchOut ? (uint32_t)EPOLLOUT : 0u, ClientWatchStream)) break;
+            }
+            epoll_event events[4];
+            int n = epoll_wait(efd, events, 4, -1);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            bool deviceReady = false;
+            for (int i = 0; i < n; ++i) {
+                uint32_t ev = events[i].events;
+                switch (events[i].data.u32) {
+                case ClientWatchDevice:
+                    deviceReady = true;
+                    break;
+                case ClientWatchDatagram:
+                    if (!receive_datagram_acks(&dtx)) goto cleanup;
+                    break;
+                case ClientWatchStream:
+                    if (dtx.fd >= 0) {
+                        // the server sends nothing on the stream after the hello ack, so
+                        // anything readable is it closing or resetting the connection
+                        char peek;
+                        ssize_t got = recv(sock, &peek, 1, MSG_PEEK | MSG_DONTWAIT);
+                        if (got >= 0 || (errno != EAGAIN && errno != EINTR)) goto cleanup;
+                        break;
+                    }
+                    // fresh: reports are only sent once the socket has drained; until
+                    // then newer state replaces the pending report.  Button changes
+                    // were queued behind the carried frame instead (see release)
+                    if (ev & (EPOLLERR | EPOLLHUP)) goto cleanup;
+                    if (!(ev & EPOLLOUT)) break;
+                    {
+                        report_alloc_check_t check(&ftx);
+                        if (!frame_tx_flush(&ftx)) goto cleanup;
+                    }
+                    if (reportPending && !frame_tx_busy(&ftx)) {
+                        if (!transmit(rawReport)) goto cleanup;
+                        reportPending = false;
+                    }
+                    break;
+                case ClientWatchPacer:
+                    if (pacer_expired(&pacer, monotonic_ns()) && !release(pacer.edgePending, rawReport)) goto cleanup;
+                    break;
+                }
+            }
+            if (!deviceReady) continue;
+        }
+
         input_event evbuf[128];
         ssize_t rd = read(fd, evbuf, sizeof(evbuf));
         if (rd <= 0) break;
@@ -219,21 +1019,41 @@ static void run_client(const std::string &device, const std::string &server_addr
         for (size_t i = 0; i < cnt; ++i) {
             const auto &e = evbuf[i];
             if (e.type == EV_SYN) {
-                if (!encode_and_transmit(sock, 1, rawReport.data(), reportSize)) goto cleanup;
+                bool edge = frameEdge;
+                frameEdge = false;
+                if (pacer.timerFd >= 0 && !pacer_sync(&pacer, monotonic_ns(), edge)) {
+                    if (pacer.edgePending) syncedReport = rawReport;
+                    continue;
+                }
+                // a button change goes out, never to be replaced by newer state
+                if (!release(edge || pacer.edgePending, rawReport)) goto cleanup;
             } else {
-                int idx = js_index_map_get(indexMap.get(), e.type, e.code);
-                if (idx < 0) continue;
-                if (e.type == EV_KEY)
-                    report.buttons[idx] = (e.value != 0);
-                else if (e.type == EV_ABS)
-                    report.absAxis[idx] = e.value;
-                else if (e.type == EV_REL)
-                    report.relAxis[idx] = e.value;
+                uint16_t slot = js_index_map_get(indexMap, e.type, e.code);
+                if (slot == JS_SLOT_NONE) continue;
+                if (e.type == EV_KEY) {
+                    uint8_t mask = (uint8_t)(1u << (slot % 8));
+                    bool down = e.value != 0;
+                    if (((raw[slot / 8] & mask) != 0) != down) {
+                        // send a pending button change, as it was at its EV_SYN, before
+                        // making the next one
+                        if (pacer.edgePending && !release(true, syncedReport)) goto cleanup;
+                        frameEdge = true;
+                    }
+                    raw[slot / 8] = down ? raw[slot / 8] | mask : raw[slot / 8] & ~mask;
+                } else if (e.type == EV_ABS) {
+                    *(int32_t *)(raw + slot) = e.value;
+                } else {
+                    *(int32_t *)(raw + slot) += e.value;
+                }
             }
         }
     }
 
 cleanup:
+    frame_tx_destroy(&ftx);
+    if (efd >= 0) close(efd);
+    if (pacer.timerFd >= 0) close(pacer.timerFd);
+    if (dtx.fd >= 0) close(dtx.fd);
     close(sock);
     close(fd);
 }
@@ -242,107 +1062,544 @@ cleanup:
 // Server mode
 
 struct client_ctx {
+    int fd;
+    frame_tx_t tx;            //!< Transmitter for replies to the client
+    tlvc_checksum_t checksum; //!< Checksum negotiated for frames from the client
+    framing_t framing;        //!< Framing negotiated for frames from the client
     slip_decode_message_t *dec;
+    uint8_t *rx;  //!< Receive buffer for length-framed messages (LENGTH_FRAME_MAX bytes)
+    size_t rxLen; //!< Bytes buffered in rx
     bool configSet;
     js_context_t *jsctx;
+    uint8_t *report;   //!< Full report reconstructed from keyframes + deltas
+    bool haveKeyframe; //!< Whether report holds a full report that deltas can apply to
+
+    // Coalescing (see receive_report)
+    bool reportPending;  //!< Whether report has not been emitted yet
+    int32_t *relPending; //!< Relative motion received since the last emit, per axis
+    uint8_t *scratch;    //!< Next report, while it is compared against the pending one
+
+    // TransportUdp session
+    uint32_t sessionId;    //!< Session id in the client's datagrams, or 0 if reports come on the stream
+    uint32_t lastSequence; //!< Sequence of the newest report applied
+    bool haveSequence;     //!< Whether any datagram report has been applied yet
+    struct keyframe_t {
+        uint32_t sequence;
+        bool valid;
+        uint8_t *data; //!< Points into keyframeData
+    } keyframes[DATAGRAM_KEYFRAMES]; //!< Acknowledged keyframes, found by sequence (see keyframe_slot)
+    uint8_t *keyframeData;
+};
+
+// Shards share nothing: each worker thread owns its clients and sessions
+// (see run_server).  Datagrams are steered to a shard by the first byte of
+// their payload, which is the low byte of the session id.
+#define SHARDS_MAX 256
+static thread_local int shardIndex = 0;
+
+// UDP sessions of this shard by id; entries live as long as their stream connection
+static thread_local std::unordered_map<uint32_t, client_ctx *> sessions;
+
+static uint32_t session_allocate(client_ctx *c) {
+    uint32_t id = 0;
+    while (id == 0 || sessions.count(id)) {
+        if (getrandom(&id, sizeof(id), 0) != sizeof(id)) id = (uint32_t)std::rand();
+        id = (id & ~0xffu) | (uint32_t)shardIndex;
+    }
+    sessions[id] = c;
+    return id;
+}
+
+// Emit only the newest report of each read burst (set once, before the server starts)
+static bool coalesceReports = false;
+
+// Configs this shard has been sent, by SHA-256 of their compact encoding, so
+// that a client whose device is already known need not send its config again.
+// Each connection still gets a uinput device of its own, created from a copy.
+#define CONFIG_CACHE_MAX 256
+
+struct config_hash_t {
+    uint8_t bytes[SHA256_DIGEST_SIZE];
+    bool operator==(const config_hash_t &other) const { return std::memcmp(bytes, other.bytes, sizeof(bytes)) == 0; }
+};
+
+struct config_hash_hasher_t {
+    // the digest is already uniformly distributed
+    size_t operator()(const config_hash_t &hash) const {
+        size_t value;
+        std::memcpy(&value, hash.bytes, sizeof(value));
+        return value;
+    }
 };
 
+static thread_local std::unordered_map<config_hash_t, std::vector<uint8_t>, config_hash_hasher_t> configCache;
+static thread_local std::deque<config_hash_t> configCacheOrder; //!< Oldest first; evicted once the cache is full
+
+static void config_cache_insert(const js_compact_config_t *config) {
+    std::vector<uint8_t> encoded(joystick_config_encoded_size(config));
+    joystick_config_encode(config, encoded.data());
+    config_hash_t hash;
+    sha256(encoded.data(), encoded.size(), hash.bytes);
+    if (configCache.count(hash)) return;
+    if (configCache.size() >= CONFIG_CACHE_MAX) {
+        configCache.erase(configCacheOrder.front());
+        configCacheOrder.pop_front();
+    }
+    configCache.emplace(hash, std::move(encoded));
+    configCacheOrder.push_back(hash);
+}
+
+// A copy of the cached config with the given hash, or NULL if there is none
+static js_compact_config_t *config_cache_lookup(const uint8_t *hashBytes) {
+    config_hash_t hash;
+    std::memcpy(hash.bytes, hashBytes, sizeof(hash.bytes));
+    auto it = configCache.find(hash);
+    if (it == configCache.end()) return nullptr;
+    return joystick_config_decode(it->second.data(), it->second.size());
+}
+
 static void *on_connect(int fd) {
     auto *c = (client_ctx *)std::calloc(1, sizeof(client_ctx));
+    c->fd = fd;
+    frame_tx_init(&c->tx, fd, sizeof(hello_t));
+    c->checksum = TlvcChecksumSum16;
+    c->framing = FramingSlip;
     c->dec = slip_decode_message_create(32768);
     slip_decode_begin(c->dec);
     c->configSet = false;
     c->jsctx = nullptr;
+    c->report = nullptr;
+    c->haveKeyframe = false;
     std::printf("Client %d connected\n", fd);
     return c;
 }
 
+static void flush_report(client_ctx *c);
+
 static void on_disconnect(void *vc) {
     auto *c = (client_ctx *)vc;
+    if (c->configSet) {
+        // the device is destroyed below, before a queued write would be made;
+        // everything queued earlier has been written before this handler runs
+        c->jsctx->writeHook = nullptr;
+        flush_report(c);
+    }
+    std::free(c->relPending);
+    std::free(c->scratch);
+    if (c->sessionId) sessions.erase(c->sessionId);
+    std::free(c->keyframeData);
     slip_decode_message_destroy(c->dec);
+    frame_tx_destroy(&c->tx);
+    std::free(c->rx);
     if (c->configSet && c->jsctx) joystick_destroy(c->jsctx);
+    std::free(c->report);
     std::printf("Client disconnected\n");
     std::free(c);
 }
 
-static bool emit_event(int fd, int type, int code, int val) {
-    input_event ie = {};
-    ie.type = type;
-    ie.code = code;
-    ie.value = val;
-    return write(fd, &ie, sizeof(ie)) == sizeof(ie);
+static void emit_report(client_ctx *c) {
+    // only the fields that differ from the previous report reach uinput
+    joystick_begin_update(c->jsctx);
+    joystick_update_report(c->jsctx, c->report);
+    if (!joystick_end_update(c->jsctx)) std::puts("report emit failed");
+}
+
+// Emit the pending report, with all the relative motion it stands for
+static void flush_report(client_ctx *c) {
+    if (!c->reportPending) return;
+    c->reportPending = false;
+    joystick_begin_update(c->jsctx);
+    joystick_update_report(c->jsctx, c->report);
+    for (int i = 0; i < c->jsctx->config->relAxisCount; ++i) {
+        joystick_update_rel_axis(c->jsctx, i, c->relPending[i]);
+        c->relPending[i] = 0;
+    }
+    if (!joystick_end_update(c->jsctx)) std::puts("report emit failed");
+}
+
+// Take the next full report from the client.  Without coalescing it is emitted
+// straight away.  With coalescing it replaces the pending report, which is
+// emitted at the end of the read burst (flush_report): absolute axes and
+// buttons are snapshots, so only the newest matters, while relative motion is
+// summed.  A button change still emits the pending report first, so no press
+// or release is lost.
+static void receive_report(client_ctx *c, const uint8_t *next) {
+    size_t reportSize = c->jsctx->reportSize;
+    if (!coalesceReports) {
+        if (next != c->report) std::memcpy(c->report, next, reportSize);
+        emit_report(c);
+        return;
+    }
+    const js_compact_config_t *config = c->jsctx->config;
+    js_report_t pending, incoming;
+    joystick_report_init(&pending, config, c->report);
+    joystick_report_init(&incoming, config, (void *)next);
+    if (c->reportPending && std::memcmp(pending.buttons, incoming.buttons, (config->buttonCount + 7) / 8) != 0) {
+        flush_report(c);
+    }
+    for (int i = 0; i < config->relAxisCount; ++i) {
+        int32_t rel;
+        std::memcpy(&rel, incoming.relAxis + i, sizeof(rel)); // payloads need not be aligned
+        c->relPending[i] += rel;
+    }
+    std::memcpy(c->report, next, reportSize);
+    c->reportPending = true;
+}
+
+// Create the connection's device from config (owned by the device from now on)
+static void configure(client_ctx *c, js_compact_config_t *config) {
+    c->jsctx = joystick_create(config);
+    // batched with the event loop's other I/O where the backend supports it
+    c->jsctx->writeHook = server_queue_write;
+    c->report = (uint8_t *)std::calloc(1, c->jsctx->reportSize ? c->jsctx->reportSize : 1);
+    if (coalesceReports) {
+        c->relPending = (int32_t *)std::calloc(config->relAxisCount + 1, sizeof(int32_t));
+        c->scratch = (uint8_t *)std::calloc(1, c->jsctx->reportSize ? c->jsctx->reportSize : 1);
+    }
+    if (c->sessionId) {
+        c->keyframeData = (uint8_t *)std::calloc(DATAGRAM_KEYFRAMES, c->jsctx->reportSize ? c->jsctx->reportSize : 1);
+        for (int i = 0; i < DATAGRAM_KEYFRAMES; ++i)
+            c->keyframes[i].data = c->keyframeData + i * c->jsctx->reportSize;
+    }
+    c->configSet = true;
 }
 
 static void handle_msg(client_ctx *c, uint16_t tag, void *data, size_t len) {
-    if (tag == 0) {
+    if (tag == MsgHello) {
+        if (c->configSet) {
+            std::puts("hello after config");
+            return;
+        }
+        hello_t hello = helloDefaults;
+        std::memcpy(&hello, data, std::min(len, sizeof(hello)));
+
+        hello_t ack = helloDefaults;
+        if (hello.checksum == TlvcChecksumCrc32c) ack.checksum = TlvcChecksumCrc32c;
+        if (hello.framing == FramingLength) ack.framing = FramingLength;
+        if (hello.compactConfig) ack.compactConfig = 1;
+        if (hello.transport == TransportUdp) {
+            ack.transport = TransportUdp;
+            if (!c->sessionId) c->sessionId = session_allocate(c);
+            ack.sessionId = c->sessionId;
+        }
+        // configured after the session exists, so that keyframe storage is set up too
+        if (hello.compactConfig) {
+            if (js_compact_config_t *config = config_cache_lookup(hello.configHash)) {
+                configure(c, config);
+                ack.configCached = 1;
+            }
+        }
+
+        // the ack still uses the current settings; everything after it uses the new ones.
+        // The client sends nothing more until it has the ack, so no frames are in flight.
+        encode_and_transmit(&c->tx, MsgHelloAck, &ack, sizeof(ack));
+        c->checksum = c->tx.checksum = (tlvc_checksum_t)ack.checksum;
+        c->framing = c->tx.framing = (framing_t)ack.framing;
+        if (c->framing == FramingLength && !c->rx) c->rx = (uint8_t *)std::malloc(LENGTH_FRAME_MAX);
+    } else if (tag == MsgConfig || tag == MsgConfigCompact) {
         if (c->configSet) {
             std::puts("config already set");
             return;
         }
-        if (len != sizeof(js_config_t)) {
-            std::printf("bad config size %zu\n", len);
+        js_compact_config_t *config = nullptr;
+        if (tag == MsgConfigCompact) {
+            config = joystick_config_decode((const uint8_t *)data, len);
+        } else if (len == sizeof(js_config_t)) {
+            js_config_t full;
+            std::memcpy(&full, data, sizeof(full)); // payloads need not be aligned
+            config = joystick_config_from_full(&full);
+        }
+        if (!config) {
+            std::printf("bad config (%zu bytes)\n", len);
             return;
         }
-        c->jsctx = joystick_create((js_config_t *)data);
-        c->configSet = true;
-    } else if (tag == 1) {
+        configure(c, config);
+        config_cache_insert(config);
+    } else if (tag == MsgReport) {
         if (!c->configSet) {
             std::puts("no config yet");
             return;
         }
-        auto *cfg = &c->jsctx->config;
-        auto *raw = (uint8_t *)data;
-        js_report_t r;
-        r.absAxis = (int32_t *)raw;
-        r.relAxis = (int32_t *)(raw + sizeof(int32_t) * cfg->absAxisCount);
-        r.buttons = raw + sizeof(int32_t) * (cfg->absAxisCount + cfg->relAxisCount);
+        if (len != c->jsctx->reportSize) {
+            std::printf("bad report size %zu\n", len);
+            return;
+        }
+        c->haveKeyframe = true;
+        receive_report(c, (const uint8_t *)data);
+    } else if (tag == MsgReportDelta) {
+        if (!c->configSet || !c->haveKeyframe) {
+            // nothing to apply the delta to; wait for the next keyframe
+            return;
+        }
+        // coalescing compares the next report with the pending one, so build it aside
+        uint8_t *next = coalesceReports ? c->scratch : c->report;
+        if (next != c->report) std::memcpy(next, c->report, c->jsctx->reportSize);
+        clear_rel_axes(c->jsctx->config, next);
+        if (!delta_apply(next, c->jsctx->reportSize, (const uint8_t *)data, len)) {
+            std::printf("bad delta report size %zu\n", len);
+            c->haveKeyframe = false;
+            return;
+        }
+        receive_report(c, next);
+    } else {
+        std::printf("unknown tag %u\n", tag);
+    }
+}
 
-        for (int i = 0; i < cfg->absAxisCount; ++i)
-            if (!emit_event(c->jsctx->fd, EV_ABS, cfg->absAxis[i], r.absAxis[i])) std::puts("ABS emit failed");
+// Decode SLIP frames from a buffer of received data
+static void dispatch_slip_frames(client_ctx *c, uint8_t *buf, size_t len) {
+    // frames are unescaped in place in buf; only a trailing partial frame is copied
+    size_t offset = 0;
+    while (offset < len) {
+        slip_frame_t frames[64];
+        size_t consumed = 0;
+        size_t count = slip_decode_buffer(c->dec, buf + offset, len - offset, frames, 64, &consumed);
+        for (size_t i = 0; i < count; ++i) {
+            tlvc_data_t tlvc;
+            if (tlvc_decode_data_checksum(&tlvc, frames[i].data, frames[i].len, c->checksum))
+                handle_msg(c, tlvc.header.tag, tlvc.data, tlvc.dataLen);
+        }
+        offset += consumed;
+    }
+}
 
-        for (int i = 0; i < cfg->relAxisCount; ++i)
-            if (!emit_event(c->jsctx->fd, EV_REL, cfg->relAxis[i], r.relAxis[i])) std::puts("REL emit failed");
+// Handle every complete length-framed message in c->rx, keeping any trailing
+// partial message for the next read.
+static bool dispatch_length_frames(client_ctx *c) {
+    size_t footerSize = tlvc_footer_size(c->checksum);
+    size_t offset = 0;
+    while (c->rxLen - offset >= sizeof(tlvc_header_t)) {
+        tlvc_header_t header;
+        std::memcpy(&header, c->rx + offset, sizeof(header));
+        size_t frameLen = sizeof(tlvc_header_t) + header.length + footerSize;
+        if (c->rxLen - offset < frameLen) break;
 
-        for (int i = 0; i < cfg->buttonCount; ++i)
-            if (!emit_event(c->jsctx->fd, EV_KEY, cfg->buttons[i], r.buttons[i])) std::puts("KEY emit failed");
+        tlvc_data_t tlvc;
+        if (!tlvc_decode_data_checksum(&tlvc, c->rx + offset, frameLen, c->checksum)) {
+            // without SLIP delimiters there is no way to resynchronise the stream
+            std::puts("bad frame checksum");
+            return false;
+        }
+        handle_msg(c, tlvc.header.tag, tlvc.data, tlvc.dataLen);
+        offset += frameLen;
+    }
+    std::memmove(c->rx, c->rx + offset, c->rxLen - offset);
+    c->rxLen -= offset;
+    return true;
+}
 
-        emit_event(c->jsctx->fd, EV_SYN, 0, 0);
+// Handle a chunk of stream data received by the server (io_uring backend).
+// data may be unescaped in place.
+static bool on_receive(void *vc, uint8_t *data, size_t len) {
+    auto *c = (client_ctx *)vc;
+    if (c->framing == FramingLength) {
+        while (len > 0) {
+            // rx holds at most one partial message, so every fill completes one
+            size_t n = std::min(len, LENGTH_FRAME_MAX - c->rxLen);
+            std::memcpy(c->rx + c->rxLen, data, n);
+            c->rxLen += n;
+            data += n;
+            len -= n;
+            if (!dispatch_length_frames(c)) return false;
+        }
     } else {
-        std::printf("unknown tag %u\n", tag);
+        dispatch_slip_frames(c, data, len);
+    }
+    if (c->configSet) flush_report(c);
+    return true;
+}
+
+// Read and handle at most budget bytes, so one busy client cannot hold up
+// the others (see server_read_round).
+static client_read_result_t read_burst(client_ctx *c, int fd, size_t budget) {
+    uint8_t buf[16384];
+    while (budget > 0) {
+        ssize_t rd;
+        if (c->framing == FramingLength) {
+            // rx always has room: it holds at most one partial message
+            rd = ::read(fd, c->rx + c->rxLen, std::min(budget, LENGTH_FRAME_MAX - c->rxLen));
+            if (rd > 0) {
+                c->rxLen += rd;
+                if (!dispatch_length_frames(c)) return ClientReadClosed;
+            }
+        } else {
+            rd = ::read(fd, buf, std::min(budget, sizeof(buf)));
+            if (rd > 0) dispatch_slip_frames(c, buf, rd);
+        }
+        if (rd == 0) return ClientReadClosed;
+        if (rd < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK ? ClientReadDrained : ClientReadClosed;
+        }
+        budget -= rd;
     }
+    return ClientReadPending;
 }
 
-static bool on_read(int fd, void *vc) {
+static client_read_result_t on_read(int fd, void *vc, size_t budget) {
     auto *c = (client_ctx *)vc;
-    uint8_t buf[256];
-    ssize_t rd;
-    while ((rd = ::read(fd, buf, sizeof(buf))) > 0) {
-        for (ssize_t i = 0; i < rd; ++i) {
-            auto rc = slip_decode_byte(c->dec, buf[i]);
-            if (rc == SlipDecodeEndOfFrame) {
-                tlvc_data_t tlvc;
-                if (tlvc_decode_data(&tlvc, c->dec->raw, c->dec->index))
-                    handle_msg(c, tlvc.header.tag, tlvc.data, tlvc.dataLen);
-                slip_decode_begin(c->dec);
-            } else if (rc != SlipDecodeOk) {
-                slip_decode_begin(c->dec);
+    client_read_result_t result = read_burst(c, fd, budget);
+    // a coalesced burst ends with its newest report (a closed client flushes on disconnect)
+    if (result != ClientReadClosed && c->configSet) flush_report(c);
+    return result;
+}
+
+// The held keyframe with the given sequence, or nullptr
+static uint8_t *keyframe_find(client_ctx *c, uint32_t sequence) {
+    for (auto &kf : c->keyframes)
+        if (kf.valid && kf.sequence == sequence) return kf.data;
+    return nullptr;
+}
+
+// Slot to hold the keyframe with the given sequence: the one already holding
+// it, else a free one, else the oldest.  Keyframes are not placed by
+// sequence, as the keyframe interval is typically a multiple of the slot
+// count, which would make each keyframe replace the delta base still in use.
+// Returns nullptr for a keyframe older than all the held ones.
+static client_ctx::keyframe_t *keyframe_slot(client_ctx *c, uint32_t sequence) {
+    client_ctx::keyframe_t *oldest = nullptr;
+    for (auto &kf : c->keyframes) {
+        if (!kf.valid || kf.sequence == sequence) return &kf;
+        // serial comparison, so the sequence may wrap
+        if (!oldest || (int32_t)(kf.sequence - oldest->sequence) < 0) oldest = &kf;
+    }
+    return (int32_t)(sequence - oldest->sequence) > 0 ? oldest : nullptr;
+}
+
+// Apply one report datagram from a session, acknowledging keyframes to from.  The
+// ack leaves from local, the address the datagram arrived on, since the client's
+// connected socket drops datagrams from any other source.
+static void handle_datagram(client_ctx *c, int fd, const sockaddr_in *from, const in_addr *local,
+                            const datagram_header_t *header, const tlvc_data_t *tlvc) {
+    if (!c->configSet) return;
+    size_t reportSize = c->jsctx->reportSize;
+    // serial comparison, so the sequence may wrap
+    bool newer = !c->haveSequence || (int32_t)(header->sequence - c->lastSequence) > 0;
+
+    if (tlvc->header.tag == MsgReport) {
+        if (tlvc->dataLen != reportSize) return;
+        if (header->flags & DatagramKeyframe) {
+            // keep and acknowledge even a late keyframe; it is still a valid delta base
+            if (auto *kf = keyframe_slot(c, header->sequence)) {
+                std::memcpy(kf->data, tlvc->data, reportSize);
+                clear_rel_axes(c->jsctx->config, kf->data);
+                kf->sequence = header->sequence;
+                kf->valid = true;
+                datagram_header_t ack = {c->sessionId, header->sequence, 0, 0};
+                send_datagram(fd, from, local, &ack, MsgKeyframeAck, nullptr, 0, c->checksum);
+            }
+        }
+        if (!newer) return;
+        std::memcpy(c->report, tlvc->data, reportSize);
+    } else if (tlvc->header.tag == MsgReportDelta) {
+        if (!newer) return;
+        const uint8_t *base = keyframe_find(c, header->base);
+        if (!base) return; // base already evicted; a newer keyframe follows
+        std::memcpy(c->report, base, reportSize);
+        if (!delta_apply(c->report, reportSize, (const uint8_t *)tlvc->data, tlvc->dataLen)) {
+            std::printf("bad delta datagram size %zu\n", tlvc->dataLen);
+            return;
+        }
+    } else {
+        return;
+    }
+    c->lastSequence = header->sequence;
+    c->haveSequence = true;
+    emit_report(c);
+}
+
+static void on_datagram(int fd) {
+    uint8_t buf[DATAGRAM_MAX];
+    while (true) {
+        sockaddr_in from = {};
+        iovec iov = {buf, sizeof(buf)};
+        alignas(cmsghdr) uint8_t control[CMSG_SPACE(sizeof(in_pktinfo))];
+        msghdr msg = {};
+        msg.msg_name = &from;
+        msg.msg_namelen = sizeof(from);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        ssize_t rd = recvmsg(fd, &msg, 0);
+        if (rd < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        // the server enables IP_PKTINFO on its datagram socket
+        const in_addr *local = nullptr;
+        in_pktinfo info;
+        for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO) {
+                std::memcpy(&info, CMSG_DATA(cmsg), sizeof(info));
+                local = &info.ipi_addr;
             }
         }
+        datagram_header_t header;
+        if ((size_t)rd < sizeof(header)) continue;
+        std::memcpy(&header, buf, sizeof(header));
+        auto it = sessions.find(header.sessionId);
+        if (it == sessions.end()) continue;
+
+        client_ctx *c = it->second;
+        tlvc_data_t tlvc;
+        if (!parse_datagram(buf, rd, c->checksum, &header, &tlvc)) continue;
+        handle_datagram(c, fd, &from, local, &header, &tlvc);
     }
-    return rd != 0 || (rd < 0 && (errno == EINTR || errno == EAGAIN));
 }
 
 //---------------------------------------------------------------------------
 // Modified run_server to take a bind address
 
-static void run_server(const std::string &bind_addr, uint16_t port) {
-    client_handlers_t handlers = {.onConnect = on_connect, .onDisconnect = on_disconnect, .onReadData = on_read};
-    auto *srv = server_create(bind_addr.c_str(), port, 10, &handlers);
-    if (!srv) {
-        std::fprintf(stderr, "Failed to create server on %s:%u\n", bind_addr.c_str(), port);
+struct server_options_t {
+    std::string bindAddress;
+    uint16_t port;
+    int maxClients;           //!< Per shard; 0 = no limit
+    int eventBatch;           //!< Events handled per epoll_wait
+    int shards;               //!< Worker threads, each with its own sockets and event loop
+    bool steer;               //!< Steer connections to shards by source address
+    server_backend_t backend; //!< Event loop implementation
+    size_t readBudget;        //!< Bytes read from a client per round
+    bool coalesce;            //!< Emit only the newest report of each read burst
+};
+
+static void run_server(const server_options_t &options) {
+    client_handlers_t handlers = {.onConnect = on_connect,
+                                  .onDisconnect = on_disconnect,
+                                  .onReadData = on_read,
+                                  .onDatagram = on_datagram,
+                                  .onReceiveData = on_receive};
+
+    // every shard binds its own sockets to the port; SO_REUSEPORT groups them
+    std::vector<server_context_t *> servers;
+    for (int i = 0; i < options.shards; ++i) {
+        auto *srv = server_create(options.bindAddress.c_str(), options.port, options.maxClients, &handlers);
+        if (!srv) {
+            std::fprintf(stderr, "Failed to create server on %s:%u\n", options.bindAddress.c_str(), options.port);
+            std::exit(1);
+        }
+        srv->eventBatch = options.eventBatch;
+        srv->backend = options.backend;
+        srv->readBudget = options.readBudget;
+        servers.push_back(srv);
+    }
+    // datagrams must reach the shard holding their session, whatever the kernel's hash says
+    if (!server_attach_shard_steering(servers.data(), options.shards, options.steer)) {
+        std::fprintf(stderr, "Failed to attach shard steering\n");
         std::exit(1);
     }
-    server_run(srv);
+
+    coalesceReports = options.coalesce;
+    std::vector<std::thread> workers;
+    for (int i = 1; i < options.shards; ++i) {
+        workers.emplace_back([&servers, i] {
+            shardIndex = i;
+            server_run(servers[i]);
+        });
+    }
+    server_run(servers[0]);
+    for (auto &worker : workers)
+        worker.join();
 }
 
 //---------------------------------------------------------------------------
@@ -353,26 +1610,73 @@ int main(int argc, char **argv) {
 
     // Server subcommand
     auto srv = app.add_subcommand("server", "Run as server");
-    std::string bind_addr;
-    uint16_t sPort;
-    srv->add_option("-b,--bind", bind_addr, "Bind address/interface")->default_val("0.0.0.0");
-    srv->add_option("-p,--port", sPort, "Listen port")->required();
+    server_options_t serverOptions = {};
+    srv->add_option("-b,--bind", serverOptions.bindAddress, "Bind address/interface")->default_val("0.0.0.0");
+    srv->add_option("-p,--port", serverOptions.port, "Listen port")->required();
+    srv->add_option("-m,--max-clients", serverOptions.maxClients, "Max simultaneous clients per shard (0 = no limit)")
+        ->default_val(0);
+    srv->add_option("-e,--event-batch", serverOptions.eventBatch, "Events handled per epoll_wait")
+        ->default_val(SERVER_DEFAULT_EVENT_BATCH);
+    srv->add_option("-s,--shards", serverOptions.shards, "Worker threads sharing the port")
+        ->check(CLI::Range(1, SHARDS_MAX))
+        ->default_val(1);
+    srv->add_option("--read-budget", serverOptions.readBudget, "Bytes read from a client before serving the others")
+        ->check(CLI::PositiveNumber)
+        ->default_val(SERVER_DEFAULT_READ_BUDGET);
+    std::map<std::string, server_backend_t> backends{{"epoll", ServerBackendEpoll}, {"uring", ServerBackendUring}};
+    srv->add_option("--backend", serverOptions.backend, "Event loop (epoll, uring; uring falls back to epoll)")
+        ->transform(CLI::CheckedTransformer(backends, CLI::ignore_case))
+        ->default_val("epoll");
+    srv->add_flag("--coalesce", serverOptions.coalesce,
+                  "Emit only the newest report of each read burst (relative motion is summed)");
+    srv->add_flag("--steer", serverOptions.steer, "Keep each client host on the same shard across reconnects");
 
     // Client subcommand
     auto cli = app.add_subcommand("client", "Run as client");
-    std::string dev, addr;
-    uint16_t cPort;
-    cli->add_option("-d,--device", dev, "Input device path")->required();
-    cli->add_option("-a,--address", addr, "Server address")->required();
-    cli->add_option("-p,--port", cPort, "Server port")->required();
+    client_options_t clientOptions = {};
+    cli->add_option("-d,--device", clientOptions.device, "Input device path")->required();
+    cli->add_option("-a,--address", clientOptions.address, "Server address")->required();
+    cli->add_option("-p,--port", clientOptions.port, "Server port")->required();
+    cli->add_option("-k,--keyframe-interval", clientOptions.keyframeInterval,
+                    "Deltas sent between full reports (0 = always send full reports)")
+        ->default_val(64);
+    std::map<std::string, tlvc_checksum_t> checksums{{"sum16", TlvcChecksumSum16}, {"crc32c", TlvcChecksumCrc32c}};
+    auto checksumOption = cli->add_option("-c,--checksum", clientOptions.checksum, "Frame checksum to negotiate (sum16, crc32c)")
+        ->transform(CLI::CheckedTransformer(checksums, CLI::ignore_case))
+        ->default_val("sum16");
+    std::map<std::string, framing_t> framings{{"slip", FramingSlip}, {"length", FramingLength}};
+    auto framingOption = cli->add_option("-f,--framing", clientOptions.framing, "Stream framing to negotiate (slip, length)")
+        ->transform(CLI::CheckedTransformer(framings, CLI::ignore_case))
+        ->default_val("slip");
+    std::map<std::string, transport_t> transports{{"tcp", TransportTcp}, {"udp", TransportUdp}};
+    auto transportOption = cli->add_option("-t,--transport", clientOptions.transport, "Transport to negotiate for reports (tcp, udp)")
+        ->transform(CLI::CheckedTransformer(transports, CLI::ignore_case))
+        ->default_val("tcp");
+    cli->add_flag("--fresh", clientOptions.fresh,
+                  "Send only the newest report once the connection drains, instead of queueing every report");
+    cli->add_option("--max-rate", clientOptions.maxRate, "Reports sent per second at most (0 = one per device report)")
+        ->check(CLI::NonNegativeNumber)
+        ->default_val(0);
+    cli->add_option("--latency-budget", clientOptions.latencyBudgetMs,
+                    "Milliseconds --max-rate may hold back a button change")
+        ->check(CLI::NonNegativeNumber)
+        ->default_val(0);
+    cli->add_flag("--original-protocol", clientOptions.originalProtocol,
+                  "Connect to a server that predates negotiation, without sending a hello; sends full reports "
+                  "only.  Not for the original release, which expects one byte per button")
+        ->excludes(checksumOption)
+        ->excludes(framingOption)
+        ->excludes(transportOption);
 
     CLI11_PARSE(app, argc, argv);
 
     if (srv->parsed()) {
-        run_server(bind_addr, sPort);
+        run_server(serverOptions);
     } else if (cli->parsed()) {
+        // a server without the hello is only sure to understand full reports
+        if (clientOptions.originalProtocol) clientOptions.keyframeInterval = 0;
         while (true) {
-            run_client(dev, addr, cPort);
+            run_client(clientOptions);
             sleep(4);
         }
     } else {